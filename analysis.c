@@ -0,0 +1,575 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "chip8.h"
+#include "analysis.h"
+#include "disasm.h"
+
+/*
+    Static analysis of a ROM as loaded at 0x200.
+
+    Reachable code is found by a worklist walk that follows the control
+    flow rules of the interpreter: jumps and calls add their target,
+    skips add both the next and the one after, RET and Bnnn end a path.
+    An opcode the interpreter rejects also ends a path, since running
+    into one almost always means the walk has left code for data.
+    A second pass cuts the reachable code into basic blocks, tracks I
+    through each block to mark the bytes Dxyn reads as sprite data, and
+    flags idle loops.
+
+    Results are cached on disk keyed by a hash of the ROM, in a layout
+    that is mapped read-only and used without any parsing.
+*/
+
+#define SET_BIT(map, addr) ((map)[((addr) & 0xFFF) >> 3] |= 1 << ((addr) & 7))
+
+uint64_t
+rom_hash(const uint8_t *rom, size_t size)
+{
+    uint64_t hash = 0xCBF29CE484222325ull ^ size;
+
+    for(size_t n = 0; n < size; n++)
+    {
+        hash ^= rom[n];
+        hash *= 0x100000001B3ull;
+    }
+
+    return hash;
+}
+
+static uint16_t
+fetch(const uint8_t *memory, uint16_t addr)
+{
+    return (memory[addr] << 8) | memory[addr + 1];
+}
+
+static int
+is_skip(uint16_t opcode)
+{
+    switch(opcode >> 12)
+    {
+        case 0x3: case 0x4: case 0x5: case 0x9: return 1;
+        case 0xE: return (opcode & 0xFF) == 0x9E || (opcode & 0xFF) == 0xA1;
+        default: return 0;
+    }
+}
+
+/*
+    Successors of a block-ending instruction at addr, or -1 if the
+    instruction does not end a block.
+*/
+
+static int
+terminator(uint16_t opcode, uint16_t addr, uint16_t succ[2], uint16_t *flags)
+{
+    succ[0] = succ[1] = NO_SUCCESSOR;
+    *flags = 0;
+
+    if(!is_valid_opcode(opcode))
+    {
+        *flags = BLOCK_INVALID;
+        return 0;
+    }
+
+    if(opcode == 0x00EE)
+    {
+        *flags = BLOCK_RETURN;
+        return 0;
+    }
+
+    if(is_skip(opcode))
+    {
+        succ[0] = addr + 2;
+        succ[1] = addr + 4;
+        return 2;
+    }
+
+    switch(opcode >> 12)
+    {
+        case 0x1:
+            succ[0] = opcode & 0x0FFF;
+            return 1;
+        case 0x2:
+            succ[0] = opcode & 0x0FFF;
+            succ[1] = addr + 2;
+            *flags = BLOCK_CALL;
+            return 2;
+        case 0xB:
+            *flags = BLOCK_INDIRECT;
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+static void
+find_reachable(RomAnalysis *analysis, const uint8_t *memory)
+{
+    // an address is queued at most once, so the stack cannot overflow
+    uint16_t work[4096];
+    uint8_t queued[4096 / 8] = { 0 };
+    int top = 0;
+
+    work[top++] = START_LOCATION;
+    SET_BIT(queued, START_LOCATION);
+    SET_BIT(analysis->block_start, START_LOCATION);
+
+    while(top)
+    {
+        uint16_t addr = work[--top];
+
+        while(addr < 4095 && !ANALYSIS_BIT(analysis->reachable, addr))
+        {
+            SET_BIT(analysis->reachable, addr);
+
+            uint16_t opcode = fetch(memory, addr);
+            uint16_t succ[2], flags;
+            int count = terminator(opcode, addr, succ, &flags);
+
+            if(count < 0)
+            {
+                addr += 2;
+                continue;
+            }
+
+            for(int n = 0; n < count; n++)
+            {
+                if(succ[n] >= 4095)
+                    continue;
+
+                if(n == 0 && ((opcode >> 12) == 0x1 || (opcode >> 12) == 0x2))
+                    SET_BIT(analysis->jump_target, succ[n]);
+
+                SET_BIT(analysis->block_start, succ[n]);
+
+                if(!ANALYSIS_BIT(analysis->reachable, succ[n]) && !ANALYSIS_BIT(queued, succ[n]))
+                {
+                    SET_BIT(queued, succ[n]);
+                    work[top++] = succ[n];
+                }
+            }
+
+            break;
+        }
+    }
+}
+
+static BasicBlock
+build_block(RomAnalysis *analysis, const uint8_t *memory, uint16_t start)
+{
+    BasicBlock block = { .start = start, .succ = { NO_SUCCESSOR, NO_SUCCESSOR } };
+    uint16_t addr = start;
+
+    for(;;)
+    {
+        uint16_t opcode = fetch(memory, addr);
+        uint16_t succ[2], flags;
+
+        if(terminator(opcode, addr, succ, &flags) >= 0)
+        {
+            block.end = addr + 2;
+            block.succ[0] = succ[0];
+            block.succ[1] = succ[1];
+            block.flags = flags;
+            return block;
+        }
+
+        if((opcode & 0xF0FF) == 0xF00A)
+            block.flags |= BLOCK_IDLE;
+
+        uint16_t next = addr + 2;
+
+        if(next >= 4095 || !ANALYSIS_BIT(analysis->reachable, next) || ANALYSIS_BIT(analysis->block_start, next))
+        {
+            block.end = next;
+            block.succ[0] = (next < 4095 && ANALYSIS_BIT(analysis->reachable, next)) ? next : NO_SUCCESSOR;
+            return block;
+        }
+
+        addr = next;
+    }
+}
+
+/*
+    Runs I through a block. Returns whether I is known on exit, and with
+    a sprite bitmap given also marks the bytes each Dxyn reads.
+*/
+
+static int
+track_i(const uint8_t *memory, const BasicBlock *block, int known, uint16_t *i, uint8_t *sprite)
+{
+    for(uint16_t addr = block->start; addr < block->end; addr += 2)
+    {
+        uint16_t opcode = fetch(memory, addr);
+
+        if((opcode >> 12) == 0xA)
+        {
+            known = 1;
+            *i = opcode & 0x0FFF;
+        }
+        else if((opcode & 0xF0FF) == 0xF01E || (opcode & 0xF0FF) == 0xF029)
+            known = 0;
+        else if((opcode >> 12) == 0xD && known && sprite)
+        {
+            for(int n = 0; n < (opcode & 0xF); n++)
+                SET_BIT(sprite, *i + n);
+        }
+    }
+
+    return known;
+}
+
+static int
+writes_i(const uint8_t *memory, const BasicBlock *block)
+{
+    for(uint16_t addr = block->start; addr < block->end; addr += 2)
+    {
+        uint16_t opcode = fetch(memory, addr);
+
+        if((opcode >> 12) == 0xA || (opcode & 0xF0FF) == 0xF01E || (opcode & 0xF0FF) == 0xF029)
+            return 1;
+    }
+
+    return 0;
+}
+
+/*
+    Whether anything reachable from a subroutine entry, up to its
+    returns, may write I. Nested calls are followed into.
+*/
+
+static int
+callee_writes_i(const RomAnalysis *analysis, const uint8_t *memory, const int16_t *index, uint16_t entry)
+{
+    uint8_t seen[4096 / 2] = { 0 };
+    uint16_t work[4096 / 2];
+    int top = 0;
+
+    if(entry >= 4096 || index[entry] < 0)
+        return 1;
+
+    work[top++] = index[entry];
+    seen[index[entry]] = 1;
+
+    while(top)
+    {
+        const BasicBlock *block = &analysis->blocks[work[--top]];
+
+        if((block->flags & BLOCK_INDIRECT) || writes_i(memory, block))
+            return 1;
+
+        for(int n = 0; n < 2; n++)
+        {
+            if(block->succ[n] >= 4096 || index[block->succ[n]] < 0 || seen[index[block->succ[n]]])
+                continue;
+
+            seen[index[block->succ[n]]] = 1;
+            work[top++] = index[block->succ[n]];
+        }
+    }
+
+    return 0;
+}
+
+/*
+    Forward dataflow of I over the CFG: a block enters with a known I
+    only if every path into it agrees. A call's return site keeps the
+    caller's I only if the callee can never write it.
+*/
+
+enum { I_UNVISITED, I_KNOWN, I_UNKNOWN };
+
+static void
+mark_sprites(RomAnalysis *analysis, const uint8_t *memory, const int16_t *index)
+{
+    uint32_t count = analysis->block_count;
+    uint8_t state[4096 / 2] = { 0 };
+    uint16_t value[4096 / 2] = { 0 };
+    uint16_t work[4096 / 2];
+    uint8_t queued[4096 / 2] = { 0 };
+    uint8_t clobbers[4096 / 2] = { 0 };
+    int top = 0;
+
+    if(!count)
+        return;
+
+    for(uint32_t b = 0; b < count; b++)
+        if(analysis->blocks[b].flags & BLOCK_CALL)
+            clobbers[b] = callee_writes_i(analysis, memory, index, analysis->blocks[b].succ[0]);
+
+    // I is 0 after reset
+    state[0] = I_KNOWN;
+    work[top++] = 0;
+    queued[0] = 1;
+
+    while(top)
+    {
+        int b = work[--top];
+        BasicBlock *block = &analysis->blocks[b];
+        uint16_t i = value[b];
+        int known = track_i(memory, block, state[b] == I_KNOWN, &i, NULL);
+
+        queued[b] = 0;
+
+        for(int n = 0; n < 2; n++)
+        {
+            if(block->succ[n] >= 4096 || index[block->succ[n]] < 0)
+                continue;
+
+            int s = index[block->succ[n]];
+            int in_known = known && !((block->flags & BLOCK_CALL) && n == 1 && clobbers[b]);
+            uint8_t old = state[s];
+
+            if(state[s] == I_UNVISITED)
+            {
+                state[s] = in_known ? I_KNOWN : I_UNKNOWN;
+                value[s] = i;
+            }
+            else if(state[s] == I_KNOWN && (!in_known || value[s] != i))
+                state[s] = I_UNKNOWN;
+
+            if(state[s] != old && !queued[s])
+            {
+                queued[s] = 1;
+                work[top++] = s;
+            }
+        }
+    }
+
+    for(uint32_t b = 0; b < count; b++)
+    {
+        uint16_t i = value[b];
+
+        track_i(memory, &analysis->blocks[b], state[b] == I_KNOWN, &i, analysis->sprite);
+    }
+}
+
+/*
+    Idle loops: a jump to itself, or the delay timer wait
+        LD Vx, DT / SE Vx, 0 / JP back
+    which shows up as a two-instruction block whose skip-not-taken
+    successor is a lone jump back to it.
+*/
+
+static void
+mark_idle_loops(RomAnalysis *analysis, const uint8_t *memory, const int16_t *index)
+{
+    for(uint32_t n = 0; n < analysis->block_count; n++)
+    {
+        BasicBlock *block = &analysis->blocks[n];
+        uint16_t last = block->end - 2;
+        uint16_t opcode = fetch(memory, last);
+
+        if((opcode >> 12) == 0x1 && (opcode & 0x0FFF) == last)
+            block->flags |= BLOCK_IDLE;
+
+        if(block->end - block->start != 4 || (fetch(memory, block->start) & 0xF0FF) != 0xF007 || !is_skip(opcode))
+            continue;
+
+        int16_t next = (block->succ[0] < 4096) ? index[block->succ[0]] : -1;
+
+        if(next < 0)
+            continue;
+
+        BasicBlock *jump = &analysis->blocks[next];
+
+        if(jump->end - jump->start == 2 && jump->succ[0] == block->start && jump->succ[1] == NO_SUCCESSOR)
+            block->flags |= BLOCK_IDLE;
+    }
+}
+
+RomAnalysis *
+analyze_rom(const uint8_t *rom, size_t size, size_t *analysis_size)
+{
+    uint8_t memory[4096 + 1] = { 0 };
+
+    if(size > MAX_ROM_SIZE)
+        size = MAX_ROM_SIZE;
+
+    memcpy(&memory[START_LOCATION], rom, size);
+
+    RomAnalysis header;
+    memset(&header, 0, sizeof(header));
+    find_reachable(&header, memory);
+
+    static const int max_blocks = 4096 / 2;
+    BasicBlock *blocks = malloc(max_blocks * sizeof(BasicBlock));
+    int16_t index[4096];
+    uint32_t count = 0;
+
+    for(int addr = 0; addr < 4096; addr++)
+        index[addr] = -1;
+
+    if(!blocks)
+        return NULL;
+
+    for(int addr = 0; addr < 4095 && count < (uint32_t)max_blocks; addr++)
+    {
+        if(!ANALYSIS_BIT(header.block_start, addr) || !ANALYSIS_BIT(header.reachable, addr))
+            continue;
+
+        index[addr] = count;
+        blocks[count++] = build_block(&header, memory, addr);
+    }
+
+    *analysis_size = sizeof(RomAnalysis) + count * sizeof(BasicBlock);
+    RomAnalysis *analysis = malloc(*analysis_size);
+
+    if(analysis)
+    {
+        memcpy(analysis, &header, sizeof(header));
+        analysis->magic = ANALYSIS_MAGIC;
+        analysis->version = ANALYSIS_VERSION;
+        analysis->rom_hash = rom_hash(rom, size);
+        analysis->rom_size = size;
+        analysis->block_count = count;
+        memcpy(analysis->blocks, blocks, count * sizeof(BasicBlock));
+
+        mark_idle_loops(analysis, memory, index);
+        mark_sprites(analysis, memory, index);
+    }
+
+    free(blocks);
+
+    return analysis;
+}
+
+static int
+cache_path(char *path, size_t size, uint64_t hash)
+{
+    const char *dir = getenv("CHIP8_CACHE_DIR");
+    char base[512];
+
+    if(dir)
+        snprintf(base, sizeof(base), "%s", dir);
+    else if(getenv("XDG_CACHE_HOME"))
+        snprintf(base, sizeof(base), "%s/chip8", getenv("XDG_CACHE_HOME"));
+    else if(getenv("HOME"))
+        snprintf(base, sizeof(base), "%s/.cache/chip8", getenv("HOME"));
+    else
+        return -1;
+
+    // create every missing directory along the way
+    for(char *p = base + 1; *p; p++)
+    {
+        if(*p != '/')
+            continue;
+
+        *p = '\0';
+        mkdir(base, 0755);
+        *p = '/';
+    }
+
+    if(mkdir(base, 0755) < 0 && errno != EEXIST)
+        return -1;
+
+    snprintf(path, size, "%s/%016llx.c8a", base, (unsigned long long)hash);
+
+    return 0;
+}
+
+static const RomAnalysis *
+map_cached(const char *path, uint64_t hash, size_t rom_size, size_t *mapped_size)
+{
+    int fd = open(path, O_RDONLY);
+
+    if(fd < 0)
+        return NULL;
+
+    struct stat st;
+    void *data = MAP_FAILED;
+
+    if(fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(RomAnalysis))
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+
+    if(data == MAP_FAILED)
+        return NULL;
+
+    const RomAnalysis *analysis = data;
+
+    if(analysis->magic != ANALYSIS_MAGIC || analysis->version != ANALYSIS_VERSION ||
+       analysis->rom_hash != hash || analysis->rom_size != rom_size ||
+       sizeof(RomAnalysis) + analysis->block_count * sizeof(BasicBlock) != (size_t)st.st_size)
+    {
+        munmap(data, st.st_size);
+        return NULL;
+    }
+
+    *mapped_size = st.st_size;
+
+    return analysis;
+}
+
+static void
+save_cached(const char *path, const RomAnalysis *analysis, size_t size)
+{
+    char tmp[640];
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+
+    // a unique name per call, so threads of one process never share a temp file
+    int fd = mkstemp(tmp);
+
+    if(fd < 0)
+        return;
+
+    int ok = fchmod(fd, 0644) == 0 && write(fd, analysis, size) == (ssize_t)size;
+
+    close(fd);
+
+    // rename is atomic, so concurrent workers only ever see whole files
+    if(!ok || rename(tmp, path) < 0)
+        unlink(tmp);
+}
+
+int
+open_analysis(AnalysisHandle *handle, const uint8_t *rom, size_t size, int use_cache)
+{
+    char path[600];
+
+    memset(handle, 0, sizeof(*handle));
+
+    if(size > MAX_ROM_SIZE)
+        size = MAX_ROM_SIZE;
+
+    uint64_t hash = rom_hash(rom, size);
+    int have_path = use_cache && cache_path(path, sizeof(path), hash) == 0;
+
+    if(have_path && (handle->analysis = map_cached(path, hash, size, &handle->size)))
+    {
+        handle->mapped = 1;
+        handle->cached = 1;
+        return 0;
+    }
+
+    RomAnalysis *analysis = analyze_rom(rom, size, &handle->size);
+
+    if(!analysis)
+        return -1;
+
+    if(have_path)
+        save_cached(path, analysis, handle->size);
+
+    handle->analysis = analysis;
+
+    return 0;
+}
+
+void
+close_analysis(AnalysisHandle *handle)
+{
+    if(handle->mapped)
+        munmap((void *)handle->analysis, handle->size);
+    else
+        free((void *)handle->analysis);
+
+    handle->analysis = NULL;
+}
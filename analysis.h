@@ -0,0 +1,64 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ANALYSIS_MAGIC 0x41384843 // "CH8A"
+#define ANALYSIS_VERSION 2
+#define NO_SUCCESSOR 0xFFFF
+
+enum
+{
+    BLOCK_CALL = 1 << 0,     // ends in 2nnn, succ[0] is the callee
+    BLOCK_RETURN = 1 << 1,   // ends in 00EE
+    BLOCK_INDIRECT = 1 << 2, // ends in Bnnn, target unknown
+    BLOCK_INVALID = 1 << 3,  // ends in an opcode the interpreter rejects
+    BLOCK_IDLE = 1 << 4      // spins on a jump to itself, DT or Fx0A
+};
+
+typedef struct
+{
+    uint16_t start;
+    uint16_t end;
+    uint16_t succ[2];
+    uint16_t flags;
+    uint16_t reserved;
+} BasicBlock;
+
+/*
+    Everything is fixed-size except the block array at the end, so the
+    cache file is exactly this struct and can be mapped and used in place.
+    Bitmaps hold one bit per address.
+*/
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t rom_hash;
+    uint32_t rom_size;
+    uint32_t block_count;
+    uint8_t reachable[4096 / 8];
+    uint8_t block_start[4096 / 8];
+    uint8_t jump_target[4096 / 8];
+    uint8_t sprite[4096 / 8];
+    BasicBlock blocks[];
+} RomAnalysis;
+
+typedef struct
+{
+    const RomAnalysis *analysis;
+    size_t size;
+    int mapped;
+    int cached;
+} AnalysisHandle;
+
+#define ANALYSIS_BIT(map, addr) (((map)[((addr) & 0xFFF) >> 3] >> ((addr) & 7)) & 1)
+
+uint64_t rom_hash(const uint8_t *rom, size_t size);
+RomAnalysis *analyze_rom(const uint8_t *rom, size_t size, size_t *analysis_size);
+int open_analysis(AnalysisHandle *handle, const uint8_t *rom, size_t size, int use_cache);
+void close_analysis(AnalysisHandle *handle);
+
+#endif
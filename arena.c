@@ -0,0 +1,51 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <sys/mman.h>
+#include "arena.h"
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+int
+init_arena(Chip8Arena *arena, size_t count)
+{
+    arena->count = count;
+    arena->size = (count * INSTANCE_STRIDE + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+    arena->huge_pages = 1;
+    arena->base = mmap(NULL, arena->size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+    if(arena->base == MAP_FAILED)
+    {
+        arena->huge_pages = 0;
+        arena->base = mmap(NULL, arena->size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if(arena->base == MAP_FAILED)
+        {
+            perror("Instance arena could not be mapped");
+            arena->base = NULL;
+            return -1;
+        }
+
+        madvise(arena->base, arena->size, MADV_HUGEPAGE);
+    }
+
+    return 0;
+}
+
+void
+free_arena(Chip8Arena *arena)
+{
+    if(arena->base)
+        munmap(arena->base, arena->size);
+
+    arena->base = NULL;
+}
+
+void
+place_instances(Chip8Arena *arena, size_t first, size_t count, const uint8_t *rom, size_t size)
+{
+    for(size_t n = first; n < first + count && n < arena->count; n++)
+        reset(arena_instance(arena, n), rom, size);
+}
@@ -0,0 +1,38 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "chip8.h"
+
+/*
+    One mapping holding many Chip8 instances back to back, each starting
+    on a cache line. Backed by explicit huge pages when the system has
+    them reserved, otherwise by transparent huge pages where enabled.
+
+    Nothing is touched at creation. Pages land on the NUMA node of the
+    thread that first writes them, so each batch worker should call
+    place_instances() on its own slice before stepping it.
+*/
+
+#define INSTANCE_STRIDE ((sizeof(Chip8) + 63) & ~(size_t)63)
+
+typedef struct
+{
+    uint8_t *base;
+    size_t count;
+    size_t size;
+    int huge_pages;
+} Chip8Arena;
+
+int init_arena(Chip8Arena *arena, size_t count);
+void free_arena(Chip8Arena *arena);
+void place_instances(Chip8Arena *arena, size_t first, size_t count, const uint8_t *rom, size_t size);
+
+static inline Chip8 *
+arena_instance(Chip8Arena *arena, size_t index)
+{
+    return (Chip8 *)(arena->base + index * INSTANCE_STRIDE);
+}
+
+#endif
@@ -0,0 +1,166 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <malloc.h>
+#include "libchip8.h"
+#include "transposition.h"
+#include "arena.h"
+
+/*
+    chip8-bench: per-call cost of chip8_step_frames() on one instance,
+    and heap usage across the timed loop, which must not move. Then the
+    cost of a state hash query and of a transposition table insert, and
+    a check that the incrementally kept hash matches a full rehash.
+
+    With an instance count, also steps that many instances round-robin,
+    once allocated one by one from the heap and once from an arena.
+*/
+
+#define MASS_ROUNDS 20
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static double
+step_instances(Chip8 **chips, long count)
+{
+    for(long n = 0; n < count; n++)
+        chip8_step_frames(chips[n], 1, 0);
+
+    uint64_t start = now_ns();
+
+    for(int round = 0; round < MASS_ROUNDS; round++)
+        for(long n = 0; n < count; n++)
+            chip8_step_frames(chips[n], 1, round);
+
+    return (double)(now_ns() - start) / (MASS_ROUNDS * count);
+}
+
+static void
+bench_instances(const uint8_t *rom, size_t size, long count)
+{
+    Chip8 **chips = malloc(count * sizeof(Chip8 *));
+    Chip8Arena arena;
+
+    for(long n = 0; n < count; n++)
+    {
+        chips[n] = chip8_create();
+        chip8_reset(chips[n], rom, size, n + 1);
+    }
+
+    double heap_ns = step_instances(chips, count);
+
+    for(long n = 0; n < count; n++)
+        chip8_destroy(chips[n]);
+
+    if(init_arena(&arena, count))
+        return;
+
+    place_instances(&arena, 0, count, rom, size);
+
+    for(long n = 0; n < count; n++)
+    {
+        chips[n] = arena_instance(&arena, n);
+        seed_random(chips[n], n + 1);
+    }
+
+    double arena_ns = step_instances(chips, count);
+
+    printf("%ld instances, %zu bytes each (%zu with padding)\n", count, sizeof(Chip8), INSTANCE_STRIDE);
+    printf("  heap:  %.1f ns/frame, %.2f M frames/s\n", heap_ns, 1e3 / heap_ns);
+    printf("  arena: %.1f ns/frame, %.2f M frames/s (%s)\n", arena_ns, 1e3 / arena_ns,
+           arena.huge_pages ? "huge pages" : "transparent huge pages if enabled");
+
+    free_arena(&arena);
+    free(chips);
+}
+
+int
+main(int argc, char **argv)
+{
+    if(argc < 2)
+    {
+        fprintf(stderr, "usage: %s rom [calls] [instances]\n", argv[0]);
+        return 1;
+    }
+
+    long calls = (argc > 2) ? atol(argv[2]) : 1000000;
+    uint8_t rom[MAX_ROM_SIZE];
+    FILE *input = fopen(argv[1], "rb");
+
+    if(!input)
+    {
+        perror("could not open rom");
+        return 1;
+    }
+
+    size_t size = fread(rom, 1, sizeof(rom), input);
+    fclose(input);
+
+    Chip8 *chip = chip8_create();
+    chip8_reset(chip, rom, size, 1);
+
+    // warm up caches and the branch predictor
+    for(int n = 0; n < 1000; n++)
+        chip8_step_frames(chip, 1, n & 0xFFFF);
+
+    struct mallinfo2 before = mallinfo2();
+    uint64_t start = now_ns();
+    uint64_t checksum = 0;
+
+    for(long n = 0; n < calls; n++)
+    {
+        chip8_step_frames(chip, 1, (n >> 4) & 0xFFFF);
+        checksum += chip8_framebuffer(chip)[n & 31];
+    }
+
+    uint64_t elapsed = now_ns() - start;
+    struct mallinfo2 after = mallinfo2();
+
+    printf("%ld calls: %.1f ns/call, %.2f ns/instruction\n", calls,
+           (double)elapsed / calls, (double)elapsed / calls / INSTRUCTIONS_PER_FRAME);
+    printf("heap in use: %zu -> %zu bytes (checksum %llx)\n",
+           before.uordblks, after.uordblks, (unsigned long long)checksum);
+
+    TranspositionTable table;
+    uint64_t hashes = 0;
+    long inserted = 0;
+
+    init_transposition(&table, 20);
+    start = now_ns();
+
+    for(long n = 0; n < calls; n++)
+        hashes += chip8_state_hash(chip) ^ n;
+
+    uint64_t hash_time = now_ns() - start;
+    start = now_ns();
+
+    for(long n = 0; n < calls; n++)
+        inserted += insert_state(&table, chip8_state_hash(chip) ^ (n & 0x3FFFF));
+
+    uint64_t insert_time = now_ns() - start;
+    Chip8 copy = *chip;
+
+    rehash(&copy);
+
+    printf("state hash: %.1f ns/call, hash + insert: %.1f ns/call (%ld new, checksum %llx)\n",
+           (double)hash_time / calls, (double)insert_time / calls, inserted, (unsigned long long)hashes);
+    printf("incremental hash %s full rehash\n", (copy.hash == chip->hash) ? "matches" : "DIFFERS FROM");
+
+    free_transposition(&table);
+    chip8_destroy(chip);
+
+    if(argc > 3)
+        bench_instances(rom, size, atol(argv[3]));
+
+    return after.uordblks != before.uordblks || copy.hash != chip->hash;
+}
@@ -3,8 +3,8 @@
 #include <string.h>
 #include <time.h>
 #include <stdlib.h>
-#include "sdl.h"
 #include "chip8.h"
+#include "image.h"
 
 #define FONTSET_START_ADDRESS 0x50
 
@@ -27,19 +27,44 @@ const uint8_t chip8_fontset[80] = {
 	0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
-#define START_LOCATION 0x200
-
-static void load_rom(Chip8 *chip, char *file);
+static size_t load_rom(char *file, uint8_t *rom, size_t size);
 
 void
 init(Chip8 *chip, char *file)
 {
-    load_rom(chip, file);
+    uint8_t rom[MAX_ROM_SIZE];
+    size_t size = load_rom(file, rom, sizeof(rom));
+
+    reset(chip, rom, size);
+    seed_random(chip, time(NULL));
+}
+
+void
+reset(Chip8 *chip, const uint8_t *rom, size_t size)
+{
+    if(size > MAX_ROM_SIZE)
+        size = MAX_ROM_SIZE;
+
+    const RomImage *image = shared_image(rom, size);
+
+    // the display is cleared below, so the state hash is the memory image's alone
+    if(image)
+    {
+        memcpy(chip->memory, image->memory, sizeof(chip->memory));
+        chip->hash = image->hash;
+    }
+    else
+        chip->hash = load_image(chip->memory, rom, size);
+
     chip->pc = START_LOCATION;
     chip->sp = 0;
     chip->i = 0;
     chip->delay_timer = 0;
     chip->sound_timer = 0;
+    chip->cycles = 0;
+    chip->draws = 0;
+    chip->unknown_opcodes = 0;
+    chip->key_watch = 0;
     
     for(int i = 0; i < 16; i++)
     {
@@ -48,32 +73,163 @@ init(Chip8 *chip, char *file)
         chip->keypad[i] = 0;
     }
 
-    for(int i = 0; i < 32 * 64; i++)
-            chip->display[i] = 0;
-    
-    memcpy(&chip->memory[FONTSET_START_ADDRESS], chip8_fontset, sizeof(chip8_fontset));
+    memset(chip->framebuffer, 0, sizeof(chip->framebuffer));
 
-    srand(time(NULL));
+    seed_random(chip, 1);
 }
 
-static void
-load_rom(Chip8 *chip, char *file)
+/*
+    Cxkk draws from a per-instance xorshift32 state instead of rand(),
+    so instances never share hidden state and a given seed always
+    replays the same way.
+*/
+
+void
+seed_random(Chip8 *chip, uint32_t seed)
+{
+    chip->rng = seed ? seed : 0x9E3779B9;
+}
+
+static size_t
+load_rom(char *file, uint8_t *rom, size_t size)
 {
     FILE *input = fopen(file, "rb");
 
-    if(!file)
+    if(!input)
     {
-        perror("could not open rom.txt");
-        return;
+        perror("could not open rom");
+        return 0;
     }
 
-    fseek(input, 0, SEEK_END);
-    int size = ftell(input);
-    fseek(input, 0, SEEK_SET);
-
-    fread(&chip->memory[0x200], 1, size, input);
+    size_t read = fread(rom, 1, size, input);
 
     fclose(input);
+
+    return read;
+}
+
+/*
+    State hashing. Memory and the display are the bulk of the state, so
+    their hash is kept up to date by the instructions that write them:
+    a Zobrist-style XOR of one mixed key per non-zero byte of memory and
+    per non-empty framebuffer row. The registers, stack, timers and RNG
+    are small enough to fold in when the hash is asked for. The keypad
+    and the cycle counter are not part of the state.
+
+    Anything that writes chip->memory or the display directly, rather
+    than through an instruction or reset(), must call rehash() afterwards.
+*/
+
+static inline uint64_t
+mix64(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDull;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ull;
+    x ^= x >> 33;
+
+    return x;
+}
+
+static inline uint64_t
+memory_key(uint16_t addr, uint8_t value)
+{
+    return value ? mix64(((uint64_t)addr << 8) | value) : 0;
+}
+
+static inline uint64_t
+row_key(int y, uint64_t row)
+{
+    return row ? mix64(row ^ (0x9E3779B97F4A7C15ull * (y + 1))) : 0;
+}
+
+// every memory index is wrapped to 12 bits; I and PC can run past 0xFFF
+static inline void
+store(Chip8 *chip, uint16_t addr, uint8_t value)
+{
+    addr &= 0xFFF;
+    chip->hash ^= memory_key(addr, chip->memory[addr]) ^ memory_key(addr, value);
+    chip->memory[addr] = value;
+}
+
+// a memory write from outside the machine, keeping the state hash current
+void
+poke(Chip8 *chip, uint16_t addr, uint8_t value)
+{
+    store(chip, addr, value);
+}
+
+void
+rehash(Chip8 *chip)
+{
+    uint64_t hash = 0;
+
+    for(int addr = 0; addr < 4096; addr++)
+        hash ^= memory_key(addr, chip->memory[addr]);
+
+    for(int y = 0; y < 32; y++)
+        hash ^= row_key(y, chip->framebuffer[y]);
+
+    chip->hash = hash;
+}
+
+// lays out the memory of a freshly reset machine and returns its hash
+uint64_t
+load_image(uint8_t *memory, const uint8_t *rom, size_t size)
+{
+    uint64_t hash = 0;
+
+    memset(memory, 0, 4096);
+
+    if(size)
+        memcpy(&memory[START_LOCATION], rom, size);
+
+    memcpy(&memory[FONTSET_START_ADDRESS], chip8_fontset, sizeof(chip8_fontset));
+
+    for(int addr = 0; addr < 4096; addr++)
+        hash ^= memory_key(addr, memory[addr]);
+
+    return hash;
+}
+
+uint64_t
+state_hash(const Chip8 *chip)
+{
+    uint64_t v[2];
+    uint64_t hash = chip->hash;
+
+    memcpy(v, chip->v, sizeof(v));
+
+    hash ^= mix64(v[0] ^ 0x8CB92BA72F3D8DD7ull);
+    hash ^= mix64(v[1] ^ 0xB492B66FBE98F273ull);
+    hash ^= mix64(((uint64_t)chip->i | (uint64_t)chip->pc << 16 | (uint64_t)chip->sp << 32 |
+                   (uint64_t)chip->delay_timer << 40 | (uint64_t)chip->sound_timer << 48) ^ 0x9AE16A3B2F90404Full);
+    hash ^= mix64(chip->rng ^ 0xC3A5C85C97CB3127ull);
+
+    // slots above sp are dead, a push always overwrites them first
+    for(int n = 0; n < chip->sp && n < 16; n++)
+        hash ^= mix64(((uint64_t)n << 16 | chip->stack[n]) ^ 0xCBF29CE484222325ull);
+
+    return hash;
+}
+
+void
+tick_timers(Chip8 *chip)
+{
+    if(chip->delay_timer)
+        chip->delay_timer--;
+    if(chip->sound_timer)
+        chip->sound_timer--;
+}
+
+void
+step_frame(Chip8 *chip)
+{
+    for(int i = 0; i < INSTRUCTIONS_PER_FRAME; i++)
+        cycle(chip);
+
+    tick_timers(chip);
 }
 
 typedef void (*Chip8Handler)(Chip8 *, uint16_t);
@@ -95,7 +251,7 @@ static void op_Dnnn(Chip8 *chip, uint16_t opcode);
 static void op_Ennn(Chip8 *chip, uint16_t opcode);
 static void op_Fnnn(Chip8 *chip, uint16_t opcode);
 
-Chip8Handler main_table[16] = {
+static const Chip8Handler main_table[16] = {
     &op_0nnn,
     &op_1nnn,
     &op_2nnn,
@@ -117,8 +273,9 @@ Chip8Handler main_table[16] = {
 void
 cycle(Chip8 *chip)
 {
-    uint16_t opcode = (chip->memory[chip->pc] << 8) | chip->memory[chip->pc + 1];
+    uint16_t opcode = (chip->memory[chip->pc & 0xFFF] << 8) | chip->memory[(chip->pc + 1) & 0xFFF];
     chip->pc += 2;
+    chip->cycles++;
 
     uint8_t msb4 = (opcode & 0xF000) >> 12;
 
@@ -144,7 +301,7 @@ op_0nnn(Chip8 *chip, uint16_t opcode)
             break;
         
         default:
-            perror("Unkown 0-series opcode");
+            chip->unknown_opcodes++;
             break;
     }
 }
@@ -157,7 +314,10 @@ op_0nnn(Chip8 *chip, uint16_t opcode)
 static void
 op_00E0(Chip8 *chip)
 {
-    memset(chip->display, 0, sizeof(chip->display));
+    for(int y = 0; y < 32; y++)
+        chip->hash ^= row_key(y, chip->framebuffer[y]);
+
+    memset(chip->framebuffer, 0, sizeof(chip->framebuffer));
 }
 
 /*
@@ -171,6 +331,10 @@ op_00E0(Chip8 *chip)
 static void
 op_00EE(Chip8 *chip)
 {
+    // a return with nothing on the stack is ignored
+    if(chip->sp == 0)
+        return;
+
     chip->pc = chip->stack[--chip->sp];
 }
 
@@ -202,6 +366,10 @@ op_2nnn(Chip8 *chip, uint16_t opcode)
 {
     uint16_t addr = opcode & 0x0FFF;
 
+    // a call that would overflow the stack is ignored
+    if(chip->sp == 16)
+        return;
+
     chip->stack[chip->sp++] = chip->pc;
     chip->pc = addr;
 }
@@ -303,7 +471,7 @@ static void op_8xy6(Chip8 *chip, uint16_t opcode);
 static void op_8xy7(Chip8 *chip, uint16_t opcode);
 static void op_8xyE(Chip8 *chip, uint16_t opcode);
 
-Chip8Handler op8nnn_table[16] = {
+static const Chip8Handler op8nnn_table[16] = {
     &op_8xy0,
     &op_8xy1,
     &op_8xy2,
@@ -330,7 +498,9 @@ op_8nnn(Chip8 *chip, uint16_t opcode)
     if(op8nnn_table[n])
         op8nnn_table[n](chip, opcode);
     else
-        perror("Unkown 8-series opcode");
+    {
+        chip->unknown_opcodes++;
+    }
 }
 
 /*
@@ -564,7 +734,14 @@ op_Cnnn(Chip8 *chip, uint16_t opcode)
     uint8_t x = (opcode & 0x0F00) >> 8;
     uint8_t kk = opcode & 0x00FF;
 
-    chip->v[x] = (rand() % 256) & kk;
+    uint32_t r = chip->rng;
+
+    r ^= r << 13;
+    r ^= r >> 17;
+    r ^= r << 5;
+    chip->rng = r;
+
+    chip->v[x] = (r >> 24) & kk;
 }
 
 /*
@@ -581,6 +758,10 @@ op_Cnnn(Chip8 *chip, uint16_t opcode)
     side of the screen. See instruction 8xy3 for more information 
     on XOR, and section 2.4, Display, for more information on 
     the Chip-8 screen and sprites.
+
+    The display is one uint64_t per row, so each sprite row is rotated
+    into place and XORed in one go; any bit set in both the row and
+    the sprite is an erased pixel.
 */
 
 static void
@@ -592,24 +773,23 @@ op_Dnnn(Chip8 *chip, uint16_t opcode)
     uint8_t Vx = chip->v[x];
     uint8_t Vy = chip->v[y];
 
+    chip->draws++;
     chip->v[0xF] = 0;
 
     for(int i = 0; i < n; i++)
     {
-        uint8_t byte = chip->memory[chip->i + i];
-
-        for(int j = 0; j < 8; j++)
-        {
-            uint8_t pixel = (byte >> (7 - j)) & 1;
-
-            int x_pos = (Vx + j) % 64;
-            int y_pos = (Vy + i) % 32;
-
-            if(pixel && chip->display[y_pos * 64 + x_pos])
-                chip->v[0xF] = 1;
-            
-            chip->display[y_pos * 64 + x_pos] ^= pixel;
-        }
+        uint8_t byte = chip->memory[(chip->i + i) & 0xFFF];
+        uint64_t row = (uint64_t)byte << 56;
+        int shift = Vx % 64;
+        int y_pos = (Vy + i) % 32;
+        uint64_t sprite = (row >> shift) | (row << ((64 - shift) & 63));
+        uint64_t old_row = chip->framebuffer[y_pos];
+
+        if(old_row & sprite)
+            chip->v[0xF] = 1;
+
+        chip->framebuffer[y_pos] = old_row ^ sprite;
+        chip->hash ^= row_key(y_pos, old_row) ^ row_key(y_pos, old_row ^ sprite);
     }
 }
 
@@ -632,11 +812,27 @@ op_Ennn(Chip8 *chip, uint16_t opcode)
             break;
 
         default:
-            perror("Unknown E-Series instruction");
+            chip->unknown_opcodes++;
             break;
     }
 }
 
+// records the first read of any watched key among keys, for input latency
+static inline void
+note_key_reads(Chip8 *chip, uint16_t keys)
+{
+    uint16_t seen = chip->key_watch & keys;
+
+    if(!seen)
+        return;
+
+    for(int k = 0; k < 16; k++)
+        if(seen & (1 << k))
+            chip->key_read_at[k] = (uint32_t)chip->cycles;
+
+    chip->key_watch &= ~seen;
+}
+
 /*
     Ex9E - SKP Vx
     Skip next instruction if key with the value of Vx is pressed.
@@ -651,7 +847,9 @@ op_Ex9E(Chip8 *chip, uint16_t opcode)
     uint8_t x = (opcode & 0x0F00) >> 8;
     uint8_t Vx = chip->v[x];
 
-    if(chip->keypad[Vx])
+    note_key_reads(chip, 1 << (Vx & 0xF));
+
+    if(chip->keypad[Vx & 0xF])
         chip->pc += 2;
 }
 
@@ -669,7 +867,9 @@ op_ExA1(Chip8 *chip, uint16_t opcode)
     uint8_t x = (opcode & 0x0F00) >> 8;
     uint8_t Vx = chip->v[x];
 
-    if(!chip->keypad[Vx])
+    note_key_reads(chip, 1 << (Vx & 0xF));
+
+    if(!chip->keypad[Vx & 0xF])
         chip->pc += 2;
 }
 
@@ -701,7 +901,7 @@ op_Fnnn(Chip8 *chip, uint16_t opcode)
         case 0x55: op_Fx55(chip, opcode); break;
         case 0x65: op_Fx65(chip, opcode); break;
         default:
-            perror("Unknown F-Series instruction");
+            chip->unknown_opcodes++;
             return;
     }
 }
@@ -734,6 +934,9 @@ op_Fx0A(Chip8 *chip, uint16_t opcode)
 {
     uint8_t x = (opcode & 0x0F00) >> 8;
 
+    // the whole keypad is scanned
+    note_key_reads(chip, 0xFFFF);
+
     for(int i = 0; i < 16; i++)
         if(chip->keypad[i]){
             chip->v[x] = i;
@@ -822,9 +1025,9 @@ op_Fx33(Chip8 *chip, uint16_t opcode)
     uint8_t x = (opcode & 0x0F00) >> 8;
     uint8_t Vx = chip->v[x];
 
-    chip->memory[chip->i] = Vx / 100;
-    chip->memory[chip->i + 1] = (Vx / 10) % 10;
-    chip->memory[chip->i + 2] = Vx % 10;
+    store(chip, chip->i, Vx / 100);
+    store(chip, chip->i + 1, (Vx / 10) % 10);
+    store(chip, chip->i + 2, Vx % 10);
 }
 
 /*
@@ -840,7 +1043,8 @@ op_Fx55(Chip8 *chip, uint16_t opcode)
 {
     uint8_t x = (opcode & 0x0F00) >> 8;
 
-    memcpy(&chip->memory[chip->i], chip->v, x + 1);    
+    for(int n = 0; n <= x; n++)
+        store(chip, chip->i + n, chip->v[n]);
 }
 
 /*
@@ -856,5 +1060,6 @@ op_Fx65(Chip8 *chip, uint16_t opcode)
 {
     uint8_t x = (opcode & 0x0F00) >> 8;
 
-    memcpy(chip->v, &chip->memory[chip->i], x + 1);   
+    for(int n = 0; n <= x; n++)
+        chip->v[n] = chip->memory[(chip->i + n) & 0xFFF];
 }
@@ -1,23 +1,68 @@
 #ifndef CHIP8_h
 #define CHIP8_h
 
+#include <stddef.h>
 #include <stdint.h>
 
+#define START_LOCATION 0x200
+#define MAX_ROM_SIZE (4096 - START_LOCATION)
+#define INSTRUCTIONS_PER_FRAME 10
+
+/*
+    Field order is deliberate. Everything nearly every instruction reads
+    or writes fits in the first 64 bytes, followed by the stack and the
+    packed display, with memory last since it is mostly only fetched
+    from. Since the fields are packed, the core wraps every memory
+    index to 12 bits and every key index to 4, and never lets sp leave
+    the stack. The display is kept one bit per pixel only, one
+    uint64_t per row with bit 63 as the leftmost pixel; use
+    chip8_pixel() to read it.
+
+    draws and unknown_opcodes count since reset, for telemetry. The
+    front end sets bits in key_watch for keys it wants to time; the
+    first Ex9E, ExA1 or Fx0A to read such a key clears its bit and
+    records the low 32 bits of cycles in key_read_at. None of these
+    are machine state and they are left out of the state hash.
+*/
+
 typedef struct
 {
-    uint8_t memory[4096];
-    uint8_t v[16];
-    uint16_t i;
     uint16_t pc;
+    uint16_t i;
     uint8_t sp;
-    uint16_t stack[16];
     uint8_t delay_timer;
     uint8_t sound_timer;
-    uint8_t display[32 * 64];
+    uint8_t v[16];
+    uint32_t rng;
+    uint64_t cycles;
+    uint64_t hash;
     uint8_t keypad[16];
+
+    uint16_t stack[16];
+    uint32_t draws;
+    uint32_t unknown_opcodes;
+    uint16_t key_watch;
+    uint32_t key_read_at[16];
+    uint64_t framebuffer[32];
+
+    uint8_t memory[4096];
 } Chip8;
 
+static inline int
+chip8_pixel(const uint64_t *framebuffer, int x, int y)
+{
+    return (framebuffer[y] >> (63 - x)) & 1;
+}
+
 void init(Chip8 *chip, char *file);
+void reset(Chip8 *chip, const uint8_t *rom, size_t size);
+void seed_random(Chip8 *chip, uint32_t seed);
 void cycle(Chip8 *chip);
+void tick_timers(Chip8 *chip);
+void step_frame(Chip8 *chip);
+void poke(Chip8 *chip, uint16_t addr, uint8_t value);
+void rehash(Chip8 *chip);
+uint64_t state_hash(const Chip8 *chip);
+uint64_t load_image(uint8_t *memory, const uint8_t *rom, size_t size);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,33 @@
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include "server.h"
+
+int
+main(int argc, char **argv)
+{
+    const char *path = DEFAULT_SOCKET_PATH;
+
+    if(argc == 3 && strcmp(argv[1], "--socket") == 0)
+        path = argv[2];
+    else if(argc != 1)
+    {
+        fprintf(stderr, "usage: %s [--socket PATH]\n", argv[0]);
+        return 1;
+    }
+
+    Server server;
+
+    if(init_server(&server, path))
+        return 1;
+
+    signal(SIGINT, stop_server);
+    signal(SIGTERM, stop_server);
+
+    fprintf(stderr, "chip8d listening on %s\n", path);
+
+    run_server(&server);
+    close_server(&server);
+
+    return 0;
+}
@@ -0,0 +1,185 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "client.h"
+
+/*
+    Blocking client for chip8d. Commands are queued with client_add()
+    between client_begin() and client_send(); the whole batch goes out
+    as one message and client_next() walks the results in order. The
+    request and reply buffers are reused across batches.
+*/
+
+static int
+reserve(uint8_t **buf, size_t *cap, size_t need)
+{
+    if(need <= *cap)
+        return 0;
+
+    size_t new_cap = *cap ? *cap : 4096;
+
+    while(new_cap < need)
+        new_cap *= 2;
+
+    uint8_t *grown = realloc(*buf, new_cap);
+
+    if(!grown)
+        return -1;
+
+    *buf = grown;
+    *cap = new_cap;
+
+    return 0;
+}
+
+int
+client_connect(Chip8Client *client, const char *path)
+{
+    memset(client, 0, sizeof(*client));
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    client->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if(client->fd < 0 || connect(client->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("Could not connect to chip8d");
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+client_close(Chip8Client *client)
+{
+    close(client->fd);
+    free(client->request);
+    free(client->reply);
+    client->request = client->reply = NULL;
+}
+
+void
+client_begin(Chip8Client *client)
+{
+    client->request_len = 4 + 2;
+    client->count = 0;
+}
+
+int
+client_add(Chip8Client *client, uint8_t op, uint16_t session, uint32_t arg, const void *payload)
+{
+    uint32_t payload_len = (op == OP_LOAD) ? arg : 0;
+
+    if(reserve(&client->request, &client->request_cap, client->request_len + COMMAND_HEADER_SIZE + payload_len))
+        return -1;
+
+    uint8_t *p = client->request + client->request_len;
+
+    p[0] = op;
+    p[1] = 0;
+    put16(p + 2, session);
+    put32(p + 4, arg);
+
+    if(payload_len)
+        memcpy(p + COMMAND_HEADER_SIZE, payload, payload_len);
+
+    client->request_len += COMMAND_HEADER_SIZE + payload_len;
+    client->count++;
+
+    return 0;
+}
+
+static int
+read_exact(int fd, uint8_t *buf, size_t len)
+{
+    while(len)
+    {
+        ssize_t n = read(fd, buf, len);
+
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return -1;
+
+        buf += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+int
+client_send(Chip8Client *client)
+{
+    if(!client->request && reserve(&client->request, &client->request_cap, 6))
+        return -1;
+
+    put32(client->request, client->request_len - 4);
+    put16(client->request + 4, client->count);
+
+    size_t sent = 0;
+
+    while(sent < client->request_len)
+    {
+        ssize_t n = send(client->fd, client->request + sent, client->request_len - sent, MSG_NOSIGNAL);
+
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0)
+            return -1;
+
+        sent += n;
+    }
+
+    uint8_t size[4];
+
+    if(read_exact(client->fd, size, 4))
+        return -1;
+
+    client->reply_len = get32(size);
+
+    if(client->reply_len < 2 || reserve(&client->reply, &client->reply_cap, client->reply_len) ||
+       read_exact(client->fd, client->reply, client->reply_len))
+        return -1;
+
+    client->remaining = get16(client->reply);
+    client->cursor = 2;
+
+    return client->remaining;
+}
+
+int
+client_next(Chip8Client *client, ClientResult *result)
+{
+    if(!client->remaining || client->reply_len - client->cursor < RESULT_HEADER_SIZE)
+        return 0;
+
+    const uint8_t *p = client->reply + client->cursor;
+
+    result->status = p[0];
+    result->session = get16(p + 2);
+    result->len = get32(p + 4);
+    result->payload = p + RESULT_HEADER_SIZE;
+
+    // a payload running past the reply means the reply is malformed; stop there
+    if(result->len > client->reply_len - client->cursor - RESULT_HEADER_SIZE)
+    {
+        client->remaining = 0;
+        return 0;
+    }
+
+    client->cursor += RESULT_HEADER_SIZE + result->len;
+    client->remaining--;
+
+    return 1;
+}
@@ -0,0 +1,37 @@
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "protocol.h"
+
+typedef struct
+{
+    uint8_t status;
+    uint16_t session;
+    uint32_t len;
+    const uint8_t *payload;
+} ClientResult;
+
+typedef struct
+{
+    int fd;
+    uint8_t *request;
+    size_t request_len;
+    size_t request_cap;
+    uint16_t count;
+    uint8_t *reply;
+    size_t reply_len;
+    size_t reply_cap;
+    size_t cursor;
+    uint16_t remaining;
+} Chip8Client;
+
+int client_connect(Chip8Client *client, const char *path);
+void client_close(Chip8Client *client);
+void client_begin(Chip8Client *client);
+int client_add(Chip8Client *client, uint8_t op, uint16_t session, uint32_t arg, const void *payload);
+int client_send(Chip8Client *client);
+int client_next(Chip8Client *client, ClientResult *result);
+
+#endif
@@ -0,0 +1,368 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "debug.h"
+#include "disasm.h"
+
+/*
+    The emulator only calls debug_check() while the debugger is armed,
+    i.e. while any breakpoint, watchpoint or condition exists or a step
+    is pending; otherwise it runs the plain cycle() loop and the debugger
+    costs nothing. Breakpoints and watchpoints are 4 KiB bitmaps indexed
+    by address. Watchpoints are resolved by decoding the next opcode, so
+    the core itself carries no hooks.
+*/
+
+#define BIT_GET(map, addr) ((map)[((addr) & 0xFFF) >> 3] & (1 << ((addr) & 7)))
+#define BIT_SET(map, addr) ((map)[((addr) & 0xFFF) >> 3] |= (1 << ((addr) & 7)))
+
+static void
+update_armed(Debugger *debugger)
+{
+    debugger->armed = debugger->breakpoint_count || debugger->watch_count ||
+                      debugger->condition_count || debugger->step >= 0;
+}
+
+void
+init_debugger(Debugger *debugger)
+{
+    memset(debugger, 0, sizeof(*debugger));
+    debugger->step = -1;
+}
+
+void
+add_breakpoint(Debugger *debugger, uint16_t addr)
+{
+    BIT_SET(debugger->breakpoints, addr);
+    debugger->breakpoint_count++;
+    update_armed(debugger);
+}
+
+void
+debug_interrupt(Debugger *debugger)
+{
+    debugger->step = 0;
+    update_armed(debugger);
+}
+
+static uint16_t
+fetch(Chip8 *chip, uint16_t addr)
+{
+    return (chip->memory[addr & 0xFFF] << 8) | chip->memory[(addr + 1) & 0xFFF];
+}
+
+static int
+range_hits(uint8_t *map, uint16_t start, int len)
+{
+    for(int i = 0; i < len; i++)
+        if(BIT_GET(map, start + i))
+            return 1;
+
+    return 0;
+}
+
+/*
+    Memory touched by the next instruction, as far as watchpoints care:
+    Fx55/Fx33 write at I, Fx65/Dxyn read at I.
+*/
+
+static int
+check_watchpoints(Debugger *debugger, Chip8 *chip, uint16_t opcode)
+{
+    uint8_t x = (opcode & 0x0F00) >> 8;
+
+    switch(opcode & 0xF0FF)
+    {
+        case 0xF055: return range_hits(debugger->write_watch, chip->i, x + 1);
+        case 0xF033: return range_hits(debugger->write_watch, chip->i, 3);
+        case 0xF065: return range_hits(debugger->read_watch, chip->i, x + 1);
+        default: break;
+    }
+
+    if((opcode & 0xF000) == 0xD000)
+        return range_hits(debugger->read_watch, chip->i, opcode & 0x000F);
+
+    return 0;
+}
+
+static uint16_t
+register_value(Chip8 *chip, uint8_t reg)
+{
+    switch(reg)
+    {
+        case COND_REG_I: return chip->i;
+        case COND_REG_SP: return chip->sp;
+        case COND_REG_DT: return chip->delay_timer;
+        case COND_REG_ST: return chip->sound_timer;
+        default: return chip->v[reg & 0xF];
+    }
+}
+
+/*
+    Conditions fire on the transition from false to true, otherwise a
+    condition like "v3 == 5" would stop on every instruction after it.
+*/
+
+static int
+check_conditions(Debugger *debugger, Chip8 *chip)
+{
+    int hit = 0;
+
+    for(int i = 0; i < debugger->condition_count; i++)
+    {
+        BreakCondition *cond = &debugger->conditions[i];
+        uint16_t value = register_value(chip, cond->reg);
+        int is_true;
+
+        switch(cond->op)
+        {
+            case '=': is_true = value == cond->value; break;
+            case '!': is_true = value != cond->value; break;
+            case '<': is_true = value < cond->value; break;
+            case '>': is_true = value > cond->value; break;
+            default: is_true = 0; break;
+        }
+
+        if(is_true && !cond->was_true)
+            hit = 1;
+
+        cond->was_true = is_true;
+    }
+
+    return hit;
+}
+
+static void
+print_registers(Chip8 *chip)
+{
+    for(int i = 0; i < 16; i++)
+        printf("V%X=%02X%s", i, chip->v[i], (i % 8 == 7) ? "\n" : " ");
+
+    printf("I=%03X PC=%03X SP=%X DT=%02X ST=%02X cycles=%llu\n", chip->i, chip->pc, chip->sp,
+           chip->delay_timer, chip->sound_timer, (unsigned long long)chip->cycles);
+}
+
+static void
+print_disassembly(Chip8 *chip, uint16_t addr, int count)
+{
+    char text[32];
+
+    for(int i = 0; i < count; i++, addr += 2)
+    {
+        uint16_t opcode = fetch(chip, addr);
+
+        disassemble(opcode, text, sizeof(text));
+        printf("%c 0x%03X  %04X  %s\n", (addr == chip->pc) ? '>' : ' ', addr & 0xFFF, opcode, text);
+    }
+}
+
+static void
+print_memory(Chip8 *chip, uint16_t addr, int len)
+{
+    for(int i = 0; i < len; i++)
+    {
+        if(i % 16 == 0)
+            printf("%s0x%03X:", i ? "\n" : "", (addr + i) & 0xFFF);
+
+        printf(" %02X", chip->memory[(addr + i) & 0xFFF]);
+    }
+
+    printf("\n");
+}
+
+static int
+parse_register(const char *name)
+{
+    if((name[0] == 'v' || name[0] == 'V') && name[1] && !name[2])
+        return (int)strtol(&name[1], NULL, 16);
+    if(strcmp(name, "i") == 0) return COND_REG_I;
+    if(strcmp(name, "sp") == 0) return COND_REG_SP;
+    if(strcmp(name, "dt") == 0) return COND_REG_DT;
+    if(strcmp(name, "st") == 0) return COND_REG_ST;
+
+    return -1;
+}
+
+static int
+parse_operator(const char *op)
+{
+    if(strcmp(op, "==") == 0)
+        return '=';
+    if(strcmp(op, "!=") == 0)
+        return '!';
+    if(strcmp(op, "<") == 0 || strcmp(op, ">") == 0)
+        return op[0];
+
+    return -1;
+}
+
+static void
+add_condition(Debugger *debugger, char *reg, char *op, char *value)
+{
+    int r = reg ? parse_register(reg) : -1;
+    int o = op ? parse_operator(op) : -1;
+
+    if(r < 0 || o < 0 || !value || debugger->condition_count == MAX_CONDITIONS)
+    {
+        printf("usage: cond v0-vf|i|sp|dt|st ==|!=|<|> hex\n");
+        return;
+    }
+
+    BreakCondition *cond = &debugger->conditions[debugger->condition_count++];
+    cond->reg = r;
+    cond->op = o;
+    cond->value = (uint16_t)strtol(value, NULL, 16);
+    cond->was_true = 0;
+}
+
+static void
+add_watch(Debugger *debugger, uint8_t *map, char *addr, char *len)
+{
+    long start = addr ? strtol(addr, NULL, 16) : -1;
+    long count = len ? strtol(len, NULL, 16) : 1;
+
+    // an empty range would arm the debugger without watching anything
+    if(start < 0 || start > 0xFFF || count < 1 || start + count > 0x1000)
+    {
+        printf("usage: watch|rwatch addr [len], len at least 1 and the range within 000-FFF\n");
+        return;
+    }
+
+    for(int i = 0; i < count; i++)
+        BIT_SET(map, start + i);
+
+    debugger->watch_count++;
+}
+
+static void
+clear_all(Debugger *debugger)
+{
+    memset(debugger->breakpoints, 0, sizeof(debugger->breakpoints));
+    memset(debugger->read_watch, 0, sizeof(debugger->read_watch));
+    memset(debugger->write_watch, 0, sizeof(debugger->write_watch));
+    debugger->breakpoint_count = 0;
+    debugger->watch_count = 0;
+    debugger->condition_count = 0;
+}
+
+static void
+print_help(void)
+{
+    printf("numbers are hex\n"
+           "  c                    continue\n"
+           "  s [n]                step n instructions\n"
+           "  b addr               break at addr\n"
+           "  watch addr [len]     break on Fx55/Fx33 writes\n"
+           "  rwatch addr [len]    break on Fx65/Dxyn reads\n"
+           "  cond reg op value    break when e.g. \"v3 == 5\" becomes true\n"
+           "  delete               remove all breakpoints, watchpoints and conditions\n"
+           "  r                    show registers\n"
+           "  x addr [len]         dump memory\n"
+           "  l [addr] [n]         disassemble\n"
+           "  q                    quit\n");
+}
+
+static void
+prompt(Debugger *debugger, Chip8 *chip)
+{
+    char line[128];
+
+    print_disassembly(chip, chip->pc, 1);
+
+    for(;;)
+    {
+        printf("(chip8) ");
+        fflush(stdout);
+
+        if(!fgets(line, sizeof(line), stdin))
+        {
+            debugger->quit = 1;
+            return;
+        }
+
+        char *cmd = strtok(line, " \t\n");
+        char *a = strtok(NULL, " \t\n");
+        char *b = strtok(NULL, " \t\n");
+        char *c = strtok(NULL, " \t\n");
+
+        if(!cmd)
+            continue;
+
+        if(strcmp(cmd, "c") == 0)
+        {
+            debugger->step = -1;
+            break;
+        }
+        else if(strcmp(cmd, "s") == 0)
+        {
+            debugger->step = a ? strtol(a, NULL, 16) : 1;
+            break;
+        }
+        else if(strcmp(cmd, "b") == 0 && a)
+            add_breakpoint(debugger, (uint16_t)strtol(a, NULL, 16));
+        else if(strcmp(cmd, "watch") == 0)
+            add_watch(debugger, debugger->write_watch, a, b);
+        else if(strcmp(cmd, "rwatch") == 0)
+            add_watch(debugger, debugger->read_watch, a, b);
+        else if(strcmp(cmd, "cond") == 0)
+            add_condition(debugger, a, b, c);
+        else if(strcmp(cmd, "delete") == 0)
+            clear_all(debugger);
+        else if(strcmp(cmd, "r") == 0)
+            print_registers(chip);
+        else if(strcmp(cmd, "x") == 0 && a)
+            print_memory(chip, (uint16_t)strtol(a, NULL, 16), b ? (int)strtol(b, NULL, 16) : 16);
+        else if(strcmp(cmd, "l") == 0)
+            print_disassembly(chip, a ? (uint16_t)strtol(a, NULL, 16) : chip->pc, b ? (int)strtol(b, NULL, 16) : 10);
+        else if(strcmp(cmd, "q") == 0)
+        {
+            debugger->quit = 1;
+            break;
+        }
+        else
+            print_help();
+    }
+
+    update_armed(debugger);
+}
+
+/*
+    Called before every instruction while armed; stops and prompts if
+    anything asks for it. Returns nonzero once the user has quit, in
+    which case the instruction must not run. The caller runs it
+    otherwise, so it can be traced like any other.
+*/
+
+int
+debug_check(Debugger *debugger, Chip8 *chip)
+{
+    if(debugger->quit)
+        return 1;
+
+    uint16_t opcode = fetch(chip, chip->pc);
+    int stop = 0;
+
+    if(debugger->step == 0)
+        stop = 1;
+    if(BIT_GET(debugger->breakpoints, chip->pc))
+        stop = 1;
+    if(check_watchpoints(debugger, chip, opcode))
+        stop = 1;
+    if(check_conditions(debugger, chip))
+        stop = 1;
+
+    // the stopped instruction runs right after the prompt, so continuing
+    // from a breakpoint does not hit it again
+    if(stop)
+    {
+        prompt(debugger, chip);
+
+        if(debugger->quit)
+            return 1;
+    }
+
+    if(debugger->step > 0)
+        debugger->step--;
+
+    return 0;
+}
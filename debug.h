@@ -0,0 +1,48 @@
+#ifndef DEBUG_H
+#define DEBUG_H
+
+#include <stdint.h>
+#include "chip8.h"
+
+#define MAX_CONDITIONS 16
+
+/*
+    reg 0x0-0xF is Vx, the rest name the other registers
+*/
+
+enum
+{
+    COND_REG_I = 16,
+    COND_REG_SP,
+    COND_REG_DT,
+    COND_REG_ST
+};
+
+typedef struct
+{
+    uint8_t reg;
+    char op;
+    uint16_t value;
+    uint8_t was_true;
+} BreakCondition;
+
+typedef struct
+{
+    uint8_t breakpoints[4096 / 8];
+    uint8_t read_watch[4096 / 8];
+    uint8_t write_watch[4096 / 8];
+    BreakCondition conditions[MAX_CONDITIONS];
+    int condition_count;
+    int breakpoint_count;
+    int watch_count;
+    long step;
+    int armed;
+    int quit;
+} Debugger;
+
+void init_debugger(Debugger *debugger);
+void add_breakpoint(Debugger *debugger, uint16_t addr);
+void debug_interrupt(Debugger *debugger);
+int debug_check(Debugger *debugger, Chip8 *chip);
+
+#endif
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <string.h>
+#include "chip8.h"
+#include "analysis.h"
+#include "disasm.h"
+
+/*
+    chip8-dis: listing of the reachable code of a ROM, with sprite data
+    shown as bytes, or its control-flow graph as a block list or in
+    Graphviz dot format. Uses the same cached analysis as every other
+    consumer.
+*/
+
+static void
+print_listing(const RomAnalysis *analysis, const uint8_t *memory)
+{
+    char text[32];
+    int addr = START_LOCATION;
+
+    while(addr < START_LOCATION + (int)analysis->rom_size)
+    {
+        if(ANALYSIS_BIT(analysis->reachable, addr))
+        {
+            uint16_t opcode = (memory[addr] << 8) | memory[addr + 1];
+
+            if(ANALYSIS_BIT(analysis->block_start, addr))
+                printf("%s%s0x%03X:\n", addr > START_LOCATION ? "\n" : "",
+                       ANALYSIS_BIT(analysis->jump_target, addr) ? "L_" : "", addr);
+
+            disassemble(opcode, text, sizeof(text));
+            printf("    0x%03X  %04X  %s\n", addr, opcode, text);
+            addr += 2;
+        }
+        else
+        {
+            printf("    0x%03X  %02X    %s\n", addr, memory[addr],
+                   ANALYSIS_BIT(analysis->sprite, addr) ? "DB (sprite)" : "DB");
+            addr++;
+        }
+    }
+}
+
+static void
+print_successors(const BasicBlock *block)
+{
+    for(int n = 0; n < 2; n++)
+        if(block->succ[n] != NO_SUCCESSOR)
+            printf(" 0x%03X", block->succ[n]);
+}
+
+static void
+print_blocks(const RomAnalysis *analysis)
+{
+    static const char *flag_names[] = { "call", "ret", "indirect", "invalid", "idle" };
+
+    for(uint32_t n = 0; n < analysis->block_count; n++)
+    {
+        const BasicBlock *block = &analysis->blocks[n];
+
+        printf("0x%03X-0x%03X ->", block->start, block->end);
+        print_successors(block);
+
+        for(int f = 0; f < 5; f++)
+            if(block->flags & (1 << f))
+                printf(" [%s]", flag_names[f]);
+
+        printf("\n");
+    }
+}
+
+static void
+print_dot(const RomAnalysis *analysis)
+{
+    printf("digraph rom {\n    node [shape=box fontname=monospace];\n");
+
+    for(uint32_t n = 0; n < analysis->block_count; n++)
+    {
+        const BasicBlock *block = &analysis->blocks[n];
+
+        printf("    b%03X [label=\"0x%03X-0x%03X\"%s];\n", block->start, block->start, block->end,
+               (block->flags & BLOCK_IDLE) ? " style=filled fillcolor=lightgray" : "");
+
+        for(int s = 0; s < 2; s++)
+            if(block->succ[s] != NO_SUCCESSOR)
+                printf("    b%03X -> b%03X%s;\n", block->start, block->succ[s],
+                       (block->flags & BLOCK_CALL) && s == 0 ? " [style=dashed]" : "");
+    }
+
+    printf("}\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    int mode = 0;
+    int use_cache = 1;
+    char *rom_path = NULL;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--cfg") == 0)
+            mode = 1;
+        else if(strcmp(argv[i], "--dot") == 0)
+            mode = 2;
+        else if(strcmp(argv[i], "--no-cache") == 0)
+            use_cache = 0;
+        else if(argv[i][0] != '-' && !rom_path)
+            rom_path = argv[i];
+        else
+            rom_path = NULL, i = argc;
+    }
+
+    if(!rom_path)
+    {
+        fprintf(stderr, "usage: %s [--cfg | --dot] [--no-cache] rom\n", argv[0]);
+        return 1;
+    }
+
+    uint8_t memory[4096 + 1] = { 0 };
+    FILE *input = fopen(rom_path, "rb");
+
+    if(!input)
+    {
+        perror("could not open rom");
+        return 1;
+    }
+
+    size_t size = fread(&memory[START_LOCATION], 1, MAX_ROM_SIZE, input);
+    fclose(input);
+
+    AnalysisHandle handle;
+
+    if(open_analysis(&handle, &memory[START_LOCATION], size, use_cache))
+        return 1;
+
+    const RomAnalysis *analysis = handle.analysis;
+
+    if(mode == 0)
+        print_listing(analysis, memory);
+    else if(mode == 1)
+        print_blocks(analysis);
+    else
+        print_dot(analysis);
+
+    fprintf(stderr, "%u blocks, analysis %s\n", analysis->block_count, handle.cached ? "from cache" : "computed");
+
+    close_analysis(&handle);
+
+    return 0;
+}
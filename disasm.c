@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include "disasm.h"
+
+/*
+    Whether the interpreter executes opcode rather than skipping it and
+    counting it in unknown_opcodes. Like the interpreter, 5xy? and 9xy?
+    ignore the low nibble.
+*/
+
+int
+is_valid_opcode(uint16_t opcode)
+{
+    switch(opcode >> 12)
+    {
+        case 0x0: return opcode == 0x00E0 || opcode == 0x00EE;
+        case 0x8: return (opcode & 0xF) <= 0x7 || (opcode & 0xF) == 0xE;
+        case 0xE: return (opcode & 0xFF) == 0x9E || (opcode & 0xFF) == 0xA1;
+        case 0xF:
+            switch(opcode & 0xFF)
+            {
+                case 0x07: case 0x0A: case 0x15: case 0x18: case 0x1E:
+                case 0x29: case 0x33: case 0x55: case 0x65: return 1;
+                default: return 0;
+            }
+        default: return 1;
+    }
+}
+
+/*
+    Mnemonics follow the ones used in the opcode comments of chip8.c.
+    Anything the interpreter would reject is printed as a data word.
+*/
+
+void
+disassemble(uint16_t opcode, char *buf, size_t size)
+{
+    uint8_t x = (opcode & 0x0F00) >> 8;
+    uint8_t y = (opcode & 0x00F0) >> 4;
+    uint8_t n = opcode & 0x000F;
+    uint8_t kk = opcode & 0x00FF;
+    uint16_t nnn = opcode & 0x0FFF;
+
+    switch(opcode >> 12)
+    {
+        case 0x0:
+            if(opcode == 0x00E0)
+                snprintf(buf, size, "CLS");
+            else if(opcode == 0x00EE)
+                snprintf(buf, size, "RET");
+            else
+                break;
+            return;
+        case 0x1: snprintf(buf, size, "JP 0x%03X", nnn); return;
+        case 0x2: snprintf(buf, size, "CALL 0x%03X", nnn); return;
+        case 0x3: snprintf(buf, size, "SE V%X, 0x%02X", x, kk); return;
+        case 0x4: snprintf(buf, size, "SNE V%X, 0x%02X", x, kk); return;
+        case 0x5: snprintf(buf, size, "SE V%X, V%X", x, y); return;
+        case 0x6: snprintf(buf, size, "LD V%X, 0x%02X", x, kk); return;
+        case 0x7: snprintf(buf, size, "ADD V%X, 0x%02X", x, kk); return;
+        case 0x8:
+        {
+            static const char *ops[16] = {
+                "LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN",
+                NULL, NULL, NULL, NULL, NULL, NULL, "SHL", NULL
+            };
+
+            if(!ops[n])
+                break;
+            snprintf(buf, size, "%s V%X, V%X", ops[n], x, y);
+            return;
+        }
+        case 0x9: snprintf(buf, size, "SNE V%X, V%X", x, y); return;
+        case 0xA: snprintf(buf, size, "LD I, 0x%03X", nnn); return;
+        case 0xB: snprintf(buf, size, "JP V0, 0x%03X", nnn); return;
+        case 0xC: snprintf(buf, size, "RND V%X, 0x%02X", x, kk); return;
+        case 0xD: snprintf(buf, size, "DRW V%X, V%X, %d", x, y, n); return;
+        case 0xE:
+            if(kk == 0x9E)
+                snprintf(buf, size, "SKP V%X", x);
+            else if(kk == 0xA1)
+                snprintf(buf, size, "SKNP V%X", x);
+            else
+                break;
+            return;
+        case 0xF:
+            switch(kk)
+            {
+                case 0x07: snprintf(buf, size, "LD V%X, DT", x); return;
+                case 0x0A: snprintf(buf, size, "LD V%X, K", x); return;
+                case 0x15: snprintf(buf, size, "LD DT, V%X", x); return;
+                case 0x18: snprintf(buf, size, "LD ST, V%X", x); return;
+                case 0x1E: snprintf(buf, size, "ADD I, V%X", x); return;
+                case 0x29: snprintf(buf, size, "LD F, V%X", x); return;
+                case 0x33: snprintf(buf, size, "LD B, V%X", x); return;
+                case 0x55: snprintf(buf, size, "LD [I], V%X", x); return;
+                case 0x65: snprintf(buf, size, "LD V%X, [I]", x); return;
+                default: break;
+            }
+            break;
+    }
+
+    snprintf(buf, size, "DW 0x%04X", opcode);
+}
@@ -0,0 +1,10 @@
+#ifndef DISASM_H
+#define DISASM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+int is_valid_opcode(uint16_t opcode);
+void disassemble(uint16_t opcode, char *buf, size_t size);
+
+#endif
@@ -1,41 +1,682 @@
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
 #include "emulator.h"
 
 #define FPS 60
-#define FRAME_DELAY (1000 / FPS)
+#define INSTRUCTIONS_PER_SECOND (INSTRUCTIONS_PER_FRAME * FPS)
 
-void
-init_emulator(Emulator *emulator, char *filename)
+/*
+    Each frame is split into INPUT_SLICES time slots. Input is polled at
+    the start of every slot and the slot's share of instructions runs
+    right after, so a key press waits at most one slot instead of a
+    whole frame before Ex9E/ExA1/Fx0A can see it. Only timer pacing
+    slices; vsync and audio pacing poll once per frame.
+*/
+
+#define INPUT_SLICES 5
+
+/*
+    SDL_Delay routinely oversleeps by a millisecond or more, so waits
+    sleep until SLEEP_MARGIN before the deadline and spin the rest.
+    A pacer more than MAX_CATCH_UP frames behind its clock resyncs
+    rather than running a burst of unpaced frames.
+*/
+
+#define SLEEP_MARGIN 0.002
+#define MAX_CATCH_UP 4
+#define FAST_PRESENT_LIMIT 10
+#define AUDIO_TIMEOUT 2
+
+/*
+    A headless frame is only ten instructions, about what one clock
+    read costs, so headless runs read the clock once per METRICS_SAMPLE
+    frames and count the whole batch as cycle time.
+*/
+
+#define METRICS_SAMPLE 64
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void
+handle_sigint(int sig)
+{
+    (void)sig;
+    interrupted = 1;
+}
+
+static void
+init_pacer(FramePacer *pacer, Platform *platform, PaceMode mode)
+{
+    pacer->mode = mode;
+    pacer->refresh_rate = (mode == PACE_VSYNC) ? platform->refresh_rate : FPS;
+    pacer->frequency = SDL_GetPerformanceFrequency();
+    pacer->period = pacer->frequency / pacer->refresh_rate;
+    pacer->deadline = SDL_GetPerformanceCounter() + pacer->period;
+    pacer->last_present = 0;
+    pacer->waited = 0;
+    pacer->audio_target = (mode == PACE_AUDIO) ? audio_clock(platform) + 1.0 / FPS : 0;
+    pacer->periods = 1;
+    pacer->instruction_budget = 0;
+    pacer->timer_budget = 0;
+    pacer->fast_presents = 0;
+
+    init_histogram(&pacer->frame_time);
+    init_histogram(&pacer->present_interval);
+    init_histogram(&pacer->jitter);
+}
+
+static uint32_t
+to_us(FramePacer *pacer, uint64_t ticks)
+{
+    return (uint32_t)(ticks * 1000000 / pacer->frequency);
+}
+
+static uint64_t
+to_ns(uint64_t ticks)
+{
+    return ticks * 1000000000 / SDL_GetPerformanceFrequency();
+}
+
+static void
+wait_until(FramePacer *pacer, uint64_t deadline)
+{
+    uint64_t margin = (uint64_t)(pacer->frequency * SLEEP_MARGIN);
+    uint64_t start = SDL_GetPerformanceCounter();
+    uint64_t now = start;
+
+    while(now < deadline)
+    {
+        if(deadline - now > margin)
+            SDL_Delay((uint32_t)((deadline - now - margin) * 1000 / pacer->frequency));
+
+        now = SDL_GetPerformanceCounter();
+    }
+
+    if(now > start)
+        observe_metric(METRIC_SLEEP_OVERSHOOT, to_us(pacer, now - deadline));
+
+    pacer->waited += now - start;
+}
+
+/*
+    The audio clock stops rising when the callback stops, e.g. with the
+    device paused or unplugged, so a wait that outlasts AUDIO_TIMEOUT
+    frames of wall time gives up on it and paces by timer instead.
+*/
+
+static void
+wait_for_audio(FramePacer *pacer, Platform *platform)
+{
+    uint64_t start = SDL_GetPerformanceCounter();
+    uint64_t give_up = start + pacer->period * AUDIO_TIMEOUT;
+    double now = audio_clock(platform);
+
+    while(now < pacer->audio_target)
+    {
+        double remaining = pacer->audio_target - now;
+
+        if(remaining > (double)MAX_CATCH_UP / FPS)
+        {
+            // the device stalled or was reset; follow it from here
+            pacer->audio_target = now;
+            break;
+        }
+
+        if(SDL_GetPerformanceCounter() > give_up)
+        {
+            fprintf(stderr, "the audio clock stopped, pacing by timer\n");
+            pacer->mode = PACE_TIMER;
+            pacer->deadline = SDL_GetPerformanceCounter();
+            break;
+        }
+
+        if(remaining > SLEEP_MARGIN)
+            SDL_Delay((uint32_t)((remaining - SLEEP_MARGIN) * 1000));
+
+        now = audio_clock(platform);
+    }
+
+    if(now > pacer->audio_target)
+        observe_metric(METRIC_SLEEP_OVERSHOOT, (uint32_t)((now - pacer->audio_target) * 1e6));
+
+    pacer->waited += SDL_GetPerformanceCounter() - start;
+}
+
+/*
+    Per-ROM settings are read from ROM.cfg next to the ROM, e.g.
+    tetris.ch8.cfg, one name=value per line with # comments. Options
+    given on the command line win.
+*/
+
+static void
+read_rom_config(EmulatorOptions *options)
+{
+    char path[4096];
+    char line[256];
+    int number = 0;
+
+    snprintf(path, sizeof(path), "%s.cfg", options->rom);
+
+    FILE *file = fopen(path, "r");
+
+    if(!file)
+        return;
+
+    while(fgets(line, sizeof(line), file))
+    {
+        char name[64];
+        int value;
+
+        number++;
+
+        if(line[strspn(line, " \t\r\n")] == '\0' || line[strspn(line, " \t")] == '#')
+            continue;
+
+        if(sscanf(line, " %63[a-z_] = %d", name, &value) != 2)
+            fprintf(stderr, "%s:%d: expected name=value\n", path, number);
+        else if(strcmp(name, "runahead") == 0)
+        {
+            if(options->runahead < 0)
+                options->runahead = value;
+        }
+        else
+            fprintf(stderr, "%s:%d: unknown setting %s\n", path, number, name);
+    }
+
+    fclose(file);
+}
+
+int
+init_emulator(Emulator *emulator, EmulatorOptions *options)
+{
+    read_rom_config(options);
+
+    emulator->headless = options->headless;
+    emulator->max_frames = options->frames;
+    emulator->has_sink = 0;
+    emulator->has_metrics = 0;
+    emulator->has_trace = 0;
+    emulator->has_netplay = 0;
+    emulator->bot_hold = 0;
+    memset(emulator->local_keypad, 0, sizeof(emulator->local_keypad));
+    emulator->runahead = options->runahead < 0 ? 0 : options->runahead;
+    emulator->runahead_ticks = 0;
+    emulator->runahead_max = 0;
+    emulator->runahead_frames = 0;
+
+    if(emulator->runahead > MAX_RUNAHEAD)
+        emulator->runahead = MAX_RUNAHEAD;
+    emulator->harvested_cycles = 0;
+    emulator->harvested_draws = 0;
+    emulator->harvested_unknown = 0;
+
+    init(&emulator->chip, options->rom);
+    emulator->pins = options->pins;
+    apply_pins(&emulator->pins, &emulator->chip);
+    init_debugger(&emulator->debugger);
+
+    for(int i = 0; i < options->breakpoint_count; i++)
+        add_breakpoint(&emulator->debugger, options->breakpoints[i]);
+
+    if(options->debug)
+    {
+        debug_interrupt(&emulator->debugger);
+        signal(SIGINT, handle_sigint);
+    }
+
+    if(options->sink_path)
+    {
+        if(open_frame_sink(&emulator->sink, options->sink_path, options->sink_format,
+                           options->sink_scale, options->sink_dedup))
+            return -1;
+
+        emulator->has_sink = 1;
+    }
+
+    if(options->metrics_path)
+    {
+        if(start_metrics_export(options->metrics_path, options->metrics_format, options->metrics_interval))
+            return -1;
+
+        emulator->has_metrics = 1;
+    }
+
+    if(options->trace_path)
+    {
+        if(open_trace(&emulator->tracer, options->trace_path, emulator->chip.cycles))
+            return -1;
+
+        emulator->has_trace = 1;
+    }
+
+    if(options->netplay.peer)
+    {
+        if(open_netplay(&emulator->netplay, &options->netplay, &emulator->chip))
+            return -1;
+
+        emulator->has_netplay = 1;
+        emulator->bot_rng = 0x2545F4914F6CDD1Dull ^ options->netplay.local_port;
+    }
+
+    if(!emulator->headless)
+    {
+        PaceMode pace = init_sdl(&emulator->platform, options->pace);
+        init_pacer(&emulator->pacer, &emulator->platform, pace);
+    }
+
+    return 0;
+}
+
+static void
+run_instructions(Emulator *emulator, int count)
+{
+    if(emulator->debugger.armed)
+    {
+        for(int i = 0; i < count && !debug_check(&emulator->debugger, &emulator->chip); i++)
+        {
+            if(emulator->has_trace)
+                trace_cycles(&emulator->tracer, &emulator->chip, 1);
+            else
+                cycle(&emulator->chip);
+        }
+    }
+    else if(emulator->has_trace)
+        trace_cycles(&emulator->tracer, &emulator->chip, count);
+    else
+    {
+        for(int i = 0; i < count; i++)
+            cycle(&emulator->chip);
+    }
+}
+
+static int
+run_frame(Emulator *emulator, int instructions)
+{
+    FramePacer *pacer = &emulator->pacer;
+    int slices = (pacer->mode == PACE_TIMER) ? INPUT_SLICES : 1;
+    uint64_t frame_start = pacer->deadline - pacer->period;
+    int done = 0;
+    int quit = 0;
+
+    for(int slice = 0; slice < slices && !quit; slice++)
+    {
+        uint64_t start = SDL_GetPerformanceCounter();
+        quit = handle_input(&emulator->platform, &emulator->chip);
+        uint64_t polled = SDL_GetPerformanceCounter();
+
+        int until = instructions * (slice + 1) / slices;
+        run_instructions(emulator, until - done);
+        done = until;
+
+        count_metric(METRIC_INPUT_NS, to_ns(polled - start));
+        count_metric(METRIC_CYCLE_NS, to_ns(SDL_GetPerformanceCounter() - polled));
+
+        if(slice == slices - 1)
+            break;
+
+        wait_until(pacer, frame_start + pacer->period * (slice + 1) / slices);
+    }
+
+    return quit;
+}
+
+/*
+    Waits for the frame's slot on the pacing clock, presents, and works
+    out how much emulated time the next frame covers. Under vsync that
+    is the number of vblanks the last present actually took, so a
+    missed vblank is made up rather than slowing the game down.
+*/
+
+static void
+present_frame(Emulator *emulator)
+{
+    FramePacer *pacer = &emulator->pacer;
+
+    if(pacer->mode == PACE_TIMER)
+        wait_until(pacer, pacer->deadline);
+    else if(pacer->mode == PACE_AUDIO)
+        wait_for_audio(pacer, &emulator->platform);
+
+    present_screen(&emulator->platform);
+    count_metric(METRIC_FRAMES_PRESENTED, 1);
+
+    uint64_t now = SDL_GetPerformanceCounter();
+
+    if(pacer->last_present)
+    {
+        uint64_t interval = now - pacer->last_present;
+        uint64_t deviation = (interval > pacer->period) ? interval - pacer->period : pacer->period - interval;
+
+        record_histogram(&pacer->present_interval, to_us(pacer, interval));
+        record_histogram(&pacer->jitter, to_us(pacer, deviation));
+
+        if(pacer->mode == PACE_VSYNC)
+        {
+            uint64_t vblanks = (interval + pacer->period / 2) / pacer->period;
+
+            if(vblanks < 1)
+                vblanks = 1;
+            if(vblanks > MAX_CATCH_UP)
+                vblanks = MAX_CATCH_UP;
+
+            pacer->periods = (int)vblanks;
+            pacer->fast_presents = (interval < pacer->period / 2) ? pacer->fast_presents + 1 : 0;
+
+            if(pacer->fast_presents >= FAST_PRESENT_LIMIT)
+            {
+                fprintf(stderr, "vsync is not being honoured, pacing by timer\n");
+                pacer->mode = PACE_TIMER;
+                pacer->refresh_rate = FPS;
+                pacer->period = pacer->frequency / FPS;
+                pacer->deadline = now;
+                pacer->periods = 1;
+                pacer->instruction_budget = 0;
+                pacer->timer_budget = 0;
+            }
+        }
+    }
+
+    pacer->last_present = now;
+
+    if(pacer->mode == PACE_TIMER)
+    {
+        pacer->deadline += pacer->period;
+
+        if(now > pacer->deadline + pacer->period * MAX_CATCH_UP)
+            pacer->deadline = now + pacer->period;
+    }
+    else if(pacer->mode == PACE_AUDIO)
+    {
+        double clock = audio_clock(&emulator->platform);
+
+        pacer->audio_target += 1.0 / FPS;
+
+        if(clock > pacer->audio_target + (double)MAX_CATCH_UP / FPS)
+            pacer->audio_target = clock + 1.0 / FPS;
+    }
+}
+
+/*
+    Run-ahead: shows the machine as it will be `runahead` frames from
+    now if the keys stay as they are, so a game that reacts to a key a
+    frame or two after reading it shows the response on the very next
+    present. The future is run on a copy of the machine, with no
+    rendering, tracing or debugger, so the snapshot is one struct copy
+    and nothing needs restoring. Each future frame ticks the timers
+    first, as the real machine will once this frame is presented.
+*/
+
+static Chip8 *
+run_ahead(Emulator *emulator)
+{
+    if(!emulator->runahead)
+        return &emulator->chip;
+
+    uint64_t start = SDL_GetPerformanceCounter();
+    Chip8 *ahead = &emulator->ahead;
+
+    *ahead = emulator->chip;
+
+    for(int frame = 0; frame < emulator->runahead; frame++)
+    {
+        tick_timers(ahead);
+
+        for(int i = 0; i < INSTRUCTIONS_PER_FRAME; i++)
+            cycle(ahead);
+
+        apply_pins(&emulator->pins, ahead);
+    }
+
+    uint64_t elapsed = SDL_GetPerformanceCounter() - start;
+
+    emulator->runahead_ticks += elapsed;
+    emulator->runahead_frames++;
+    if(elapsed > emulator->runahead_max)
+        emulator->runahead_max = elapsed;
+    count_metric(METRIC_RUNAHEAD_NS, to_ns(elapsed));
+
+    return ahead;
+}
+
+static void
+print_runahead_stats(Emulator *emulator)
+{
+    if(!emulator->runahead_frames)
+        return;
+
+    double average = (double)to_ns(emulator->runahead_ticks) / emulator->runahead_frames;
+    double period = 1e9 * emulator->pacer.periods / emulator->pacer.refresh_rate;
+
+    fprintf(stderr, "run-ahead: %d frames, %.2f us/frame average, %.2f us max, %.3f%% of the frame budget\n",
+            emulator->runahead, average / 1e3, to_ns(emulator->runahead_max) / 1e3, 100 * average / period);
+}
+
+static void
+print_pace_stats(FramePacer *pacer)
+{
+    static const char *modes[] = { "timer", "vsync", "audio" };
+    Histogram *interval = &pacer->present_interval;
+
+    if(interval->count)
+        fprintf(stderr, "pacing: %s, %.3f Hz presented\n", modes[pacer->mode],
+                interval->count * 1e6 / interval->sum);
+
+    print_histogram(&pacer->frame_time, "frame time", stderr);
+    print_histogram(&pacer->present_interval, "present interval", stderr);
+    print_histogram(&pacer->jitter, "present jitter", stderr);
+}
+
+/*
+    Moves what the chip counted since the last call into this thread's
+    metrics shard. A netplay rollback restores an older snapshot and
+    replays it with the real remote input, which can draw less or hit
+    fewer unknown opcodes than the prediction that was already
+    harvested; such a count is taken as the new baseline rather than
+    wrapping around. Instructions are a fixed number per frame and only
+    grow.
+*/
+
+static void
+harvest_metrics(Emulator *emulator)
 {
-    init(&emulator->chip, filename);
-    init_sdl(&emulator->platform);
+    Chip8 *chip = &emulator->chip;
+
+    count_metric(METRIC_INSTRUCTIONS, chip->cycles - emulator->harvested_cycles);
+
+    if(chip->draws >= emulator->harvested_draws)
+        count_metric(METRIC_DRAWS, chip->draws - emulator->harvested_draws);
+    if(chip->unknown_opcodes >= emulator->harvested_unknown)
+        count_metric(METRIC_UNKNOWN_OPCODES, chip->unknown_opcodes - emulator->harvested_unknown);
+
+    emulator->harvested_cycles = chip->cycles;
+    emulator->harvested_draws = chip->draws;
+    emulator->harvested_unknown = chip->unknown_opcodes;
+}
+
+/*
+    Headless netplay has nobody at the keyboard, so each peer plays
+    its own keys at random: a combination of about two keys, held for
+    1 to 32 frames.
+*/
+
+static uint16_t
+bot_keys(Emulator *emulator)
+{
+    if(emulator->bot_hold-- <= 0)
+    {
+        uint64_t r = emulator->bot_rng;
+
+        r ^= r << 13;
+        r ^= r >> 7;
+        r ^= r << 17;
+        emulator->bot_rng = r;
+
+        emulator->bot_keys = (uint16_t)(r & (r >> 16) & (r >> 32));
+        emulator->bot_hold = (r >> 48) & 31;
+    }
+
+    return emulator->bot_keys;
+}
+
+/*
+    Runs the 60 Hz frames due this display frame through netplay. The
+    keypad the machine sees is the merged one netplay sets, so the
+    local key state is kept aside and only passed through handle_input.
+*/
+
+static int
+run_netplay_frames(Emulator *emulator, int frames)
+{
+    Chip8 *chip = &emulator->chip;
+    uint16_t keys = 0;
+    int quit;
+
+    memcpy(chip->keypad, emulator->local_keypad, sizeof(chip->keypad));
+    quit = handle_input(&emulator->platform, chip);
+    memcpy(emulator->local_keypad, chip->keypad, sizeof(chip->keypad));
+
+    for(int k = 0; k < 16; k++)
+        keys |= emulator->local_keypad[k] << k;
+
+    for(int n = 0; n < frames && !quit; n++)
+        quit = netplay_frame(&emulator->netplay, chip, keys) < 0;
+
+    return quit;
+}
+
+static void
+close_netplay_session(Emulator *emulator)
+{
+    if(finish_netplay(&emulator->netplay, &emulator->chip, 5000))
+        fprintf(stderr, "netplay: peer input missing at the end, final state is unconfirmed\n");
+
+    printf("netplay: frame %u state %016llx\n", emulator->netplay.frame,
+           (unsigned long long)state_hash(&emulator->chip));
+
+    print_netplay_stats(&emulator->netplay);
+    close_netplay(&emulator->netplay);
 }
 
 void
 run_emulator(Emulator *emulator)
 {
+    FramePacer *pacer = &emulator->pacer;
+    uint64_t batch_start = 0;
     int quit = 0;
+    long frames = 0;
 
     while(!quit)
     {
-        uint32_t frame_start = SDL_GetTicks();
-        
-        quit = handle_input(&emulator->chip);
+        if(interrupted)
+        {
+            interrupted = 0;
+            debug_interrupt(&emulator->debugger);
+        }
 
-        for (int i = 0; i < 10; i++)
-            cycle(&emulator->chip);
-        
-        render_screen(&emulator->platform, &emulator->chip);
-        
-        uint32_t frame_time = SDL_GetTicks() - frame_start;
-
-        if(FRAME_DELAY > frame_time)
-            SDL_Delay(FRAME_DELAY - frame_time);
-        
-        if(emulator->chip.delay_timer)
-            emulator->chip.delay_timer--;
-        if(emulator->chip.sound_timer)
-            emulator->chip.sound_timer--;
-    }
-
-    close_sdl(&emulator->platform);
-}
\ No newline at end of file
+        if(emulator->headless)
+        {
+            if(frames % METRICS_SAMPLE == 0)
+            {
+                uint64_t now = SDL_GetPerformanceCounter();
+
+                if(frames)
+                    count_metric(METRIC_CYCLE_NS, to_ns(now - batch_start));
+                batch_start = now;
+            }
+
+            if(emulator->has_netplay)
+                quit = netplay_frame(&emulator->netplay, &emulator->chip, bot_keys(emulator)) < 0;
+            else
+            {
+                run_instructions(emulator, INSTRUCTIONS_PER_FRAME);
+                apply_pins(&emulator->pins, &emulator->chip);
+            }
+
+            if(emulator->has_sink)
+                write_frame(&emulator->sink, emulator->chip.framebuffer);
+
+            // netplay frames tick their own timers, so a rollback replays them
+            if(!emulator->has_netplay)
+                tick_timers(&emulator->chip);
+            count_metric(METRIC_FRAMES_EMULATED, 1);
+        }
+        else
+        {
+            uint64_t frame_start = SDL_GetPerformanceCounter();
+
+            pacer->waited = 0;
+            pacer->instruction_budget += INSTRUCTIONS_PER_SECOND * pacer->periods;
+            pacer->timer_budget += FPS * pacer->periods;
+
+            int instructions = (int)(pacer->instruction_budget / pacer->refresh_rate);
+            pacer->instruction_budget %= pacer->refresh_rate;
+
+            if(emulator->has_netplay)
+                quit = run_netplay_frames(emulator, (int)(pacer->timer_budget / pacer->refresh_rate));
+            else
+            {
+                quit = run_frame(emulator, instructions);
+                apply_pins(&emulator->pins, &emulator->chip);
+            }
+
+            Chip8 *shown = run_ahead(emulator);
+            uint64_t rendering = SDL_GetPerformanceCounter();
+            render_screen(&emulator->platform, shown);
+            count_metric(METRIC_RENDER_NS, to_ns(SDL_GetPerformanceCounter() - rendering));
+            set_beeper(&emulator->platform, emulator->chip.sound_timer > 0);
+
+            uint64_t busy = SDL_GetPerformanceCounter() - frame_start - pacer->waited;
+            record_histogram(&pacer->frame_time, to_us(pacer, busy));
+            observe_metric(METRIC_FRAME_TIME, to_us(pacer, busy));
+
+            present_frame(emulator);
+
+            // the sink gets one frame per emulated 60 Hz frame, matching its F60:1 header
+            for(; pacer->timer_budget >= (uint64_t)pacer->refresh_rate; pacer->timer_budget -= pacer->refresh_rate)
+            {
+                if(emulator->has_sink)
+                    write_frame(&emulator->sink, emulator->chip.framebuffer);
+                if(!emulator->has_netplay)
+                    tick_timers(&emulator->chip);
+                count_metric(METRIC_FRAMES_EMULATED, 1);
+            }
+        }
+
+        harvest_metrics(emulator);
+
+        if(++frames == emulator->max_frames)
+            quit = 1;
+        if(emulator->debugger.quit)
+            quit = 1;
+    }
+
+    if(emulator->has_netplay)
+        close_netplay_session(emulator);
+
+    // the core only counts these, so they are reported once here
+    if(emulator->chip.unknown_opcodes)
+        fprintf(stderr, "%u unknown opcodes were skipped\n", emulator->chip.unknown_opcodes);
+
+    if(emulator->has_sink)
+        close_frame_sink(&emulator->sink);
+
+    if(emulator->has_trace)
+    {
+        uint64_t records = close_trace(&emulator->tracer);
+
+        fprintf(stderr, "trace: %llu records, %llu stalls\n", (unsigned long long)records,
+                (unsigned long long)emulator->tracer.stalls);
+    }
+
+    if(emulator->has_metrics)
+        stop_metrics_export();
+
+    if(!emulator->headless)
+    {
+        print_input_stats(&emulator->platform);
+        print_pace_stats(pacer);
+        print_runahead_stats(emulator);
+        close_sdl(&emulator->platform);
+    }
+}
@@ -3,14 +3,97 @@
 
 #include "chip8.h"
 #include "sdl.h"
+#include "framesink.h"
+#include "debug.h"
+#include "histogram.h"
+#include "metrics.h"
+#include "trace.h"
+#include "ramsearch.h"
+#include "netplay.h"
+
+typedef struct
+{
+    char *rom;
+    int headless;
+    long frames;
+    char *sink_path;
+    SinkFormat sink_format;
+    int sink_scale;
+    int sink_dedup;
+    int debug;
+    int breakpoint_count;
+    uint16_t breakpoints[16];
+    PaceMode pace;
+    char *metrics_path;
+    MetricsFormat metrics_format;
+    int metrics_interval;
+    char *trace_path;
+    PinSet pins;
+    int runahead;
+    NetplayOptions netplay;
+} EmulatorOptions;
+
+/*
+    Frame pacing state. Each frame covers `periods` periods of the
+    pacing clock, i.e. periods / refresh_rate seconds. Instructions and
+    60 Hz timer ticks are drawn from budgets kept in units of
+    1 / refresh_rate, so a 144 Hz display still runs the machine at
+    exactly 600 instructions per second with no rounding drift.
+    Performance counter values are in ticks of `frequency`.
+*/
+
+typedef struct
+{
+    PaceMode mode;
+    uint64_t frequency;
+    uint64_t period;
+    uint64_t deadline;
+    uint64_t last_present;
+    uint64_t waited;
+    double audio_target;
+    uint64_t instruction_budget;
+    uint64_t timer_budget;
+    int refresh_rate;
+    int periods;
+    int fast_presents;
+    Histogram frame_time;
+    Histogram present_interval;
+    Histogram jitter;
+} FramePacer;
+
+#define MAX_RUNAHEAD 8
 
 typedef struct
 {
     Chip8 chip;
     Platform platform;
+    int headless;
+    long max_frames;
+    FrameSink sink;
+    int has_sink;
+    Debugger debugger;
+    FramePacer pacer;
+    int has_metrics;
+    uint64_t harvested_cycles;
+    uint32_t harvested_draws;
+    uint32_t harvested_unknown;
+    Tracer tracer;
+    int has_trace;
+    PinSet pins;
+    int runahead;
+    uint64_t runahead_ticks;
+    uint64_t runahead_max;
+    long runahead_frames;
+    Chip8 ahead;
+    Netplay netplay;
+    int has_netplay;
+    uint8_t local_keypad[16];
+    uint16_t bot_keys;
+    int bot_hold;
+    uint64_t bot_rng;
 } Emulator;
 
-void init_emulator(Emulator *emulator, char *filename);
+int init_emulator(Emulator *emulator, EmulatorOptions *options);
 void run_emulator(Emulator *emulator);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "framesink.h"
+#include "chip8.h"
+
+/*
+    Frames are scaled into a small ring of slots and handed to the kernel
+    in batches with writev, one header/payload pair per frame. An identical
+    consecutive frame never gets rescaled: raw RGBA repeats the previous
+    slot, Y4M with dedup enabled drops it and tags the next header with
+    XDUP=n, meaning the frame before that header was held for n extra
+    periods. Decoders ignore X parameters, so the stream stays valid Y4M.
+*/
+
+#define WIDTH 64
+#define HEIGHT 32
+
+int
+open_frame_sink(FrameSink *sink, const char *path, SinkFormat format, int scale, int dedup)
+{
+    memset(sink, 0, sizeof(*sink));
+    sink->format = format;
+    sink->scale = scale;
+    sink->dedup = dedup && format == SINK_Y4M;
+
+    size_t bytes_per_pixel = (format == SINK_RGBA) ? 4 : 1;
+    sink->frame_size = (size_t)WIDTH * scale * HEIGHT * scale * bytes_per_pixel;
+
+    if(strcmp(path, "-") == 0)
+        sink->fd = STDOUT_FILENO;
+    else
+        sink->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if(sink->fd < 0)
+    {
+        perror("Frame sink could not be opened");
+        return -1;
+    }
+
+    sink->frames = malloc(sink->frame_size * SINK_BATCH);
+
+    if(!sink->frames)
+    {
+        perror("Frame sink buffers could not be allocated");
+        if(sink->fd != STDOUT_FILENO)
+            close(sink->fd);
+        return -1;
+    }
+
+    sink->slot = SINK_BATCH - 1;
+
+    if(format == SINK_Y4M)
+    {
+        char header[64];
+        int len = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 Cmono\n",
+                           WIDTH * scale, HEIGHT * scale);
+
+        if(write(sink->fd, header, len) != len)
+            perror("Frame sink header could not be written");
+    }
+
+    return 0;
+}
+
+static void
+flush_frames(FrameSink *sink)
+{
+    struct iovec *iov = sink->iov;
+    int count = sink->iov_count;
+
+    while(count > 0)
+    {
+        ssize_t n = writev(sink->fd, iov, count);
+
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            perror("Frame sink write failed");
+            break;
+        }
+
+        while(count > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+
+        if(count > 0)
+        {
+            iov->iov_base = (uint8_t *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    sink->iov_count = 0;
+    sink->slots_queued = 0;
+}
+
+static void
+scale_frame(FrameSink *sink, const uint64_t *framebuffer, uint8_t *out)
+{
+    int scale = sink->scale;
+    size_t row_size = sink->frame_size / HEIGHT / scale;
+
+    for(int y = 0; y < HEIGHT; y++)
+    {
+        uint8_t *row = out + (size_t)y * scale * row_size;
+
+        if(sink->format == SINK_RGBA)
+        {
+            static const uint8_t white[4] = { 0xFF, 0xFF, 0xFF, 0xFF };
+            static const uint8_t black[4] = { 0x00, 0x00, 0x00, 0xFF };
+            uint8_t *pixel = row;
+
+            for(int x = 0; x < WIDTH; x++)
+                for(int s = 0; s < scale; s++, pixel += 4)
+                    memcpy(pixel, chip8_pixel(framebuffer, x, y) ? white : black, 4);
+        }
+        else
+        {
+            for(int x = 0; x < WIDTH; x++)
+                memset(&row[x * scale], chip8_pixel(framebuffer, x, y) ? 0xFF : 0x00, scale);
+        }
+
+        for(int s = 1; s < scale; s++)
+            memcpy(row + s * row_size, row, row_size);
+    }
+}
+
+static void
+queue_frame(FrameSink *sink, uint64_t repeats)
+{
+    if(sink->format == SINK_Y4M)
+    {
+        char *header = sink->headers[sink->iov_count / 2];
+        int len;
+
+        if(repeats)
+            len = snprintf(header, sizeof(sink->headers[0]), "FRAME XDUP=%llu\n", (unsigned long long)repeats);
+        else
+            len = snprintf(header, sizeof(sink->headers[0]), "FRAME\n");
+
+        sink->iov[sink->iov_count].iov_base = header;
+        sink->iov[sink->iov_count].iov_len = len;
+        sink->iov_count++;
+    }
+
+    sink->iov[sink->iov_count].iov_base = sink->frames + sink->slot * sink->frame_size;
+    sink->iov[sink->iov_count].iov_len = sink->frame_size;
+    sink->iov_count++;
+    sink->written++;
+
+    if(sink->iov_count + 2 > SINK_BATCH * 2)
+        flush_frames(sink);
+}
+
+void
+write_frame(FrameSink *sink, const uint64_t *framebuffer)
+{
+    if(sink->have_last && memcmp(sink->last, framebuffer, sizeof(sink->last)) == 0)
+    {
+        sink->duplicates++;
+
+        if(sink->dedup)
+            sink->repeats++;
+        else
+            queue_frame(sink, 0);
+
+        return;
+    }
+
+    // duplicates requeue the current slot, so the ring must not wrap onto it
+
+    if(sink->slots_queued == SINK_BATCH - 1)
+        flush_frames(sink);
+
+    sink->slot = (sink->slot + 1) % SINK_BATCH;
+    sink->slots_queued++;
+
+    scale_frame(sink, framebuffer, sink->frames + sink->slot * sink->frame_size);
+    memcpy(sink->last, framebuffer, sizeof(sink->last));
+    sink->have_last = 1;
+
+    queue_frame(sink, sink->repeats);
+    sink->repeats = 0;
+}
+
+void
+close_frame_sink(FrameSink *sink)
+{
+    if(sink->repeats)
+        queue_frame(sink, sink->repeats - 1);
+
+    flush_frames(sink);
+
+    fprintf(stderr, "frame sink: %llu frames written, %llu duplicates\n",
+            (unsigned long long)sink->written, (unsigned long long)sink->duplicates);
+
+    if(sink->fd != STDOUT_FILENO)
+        close(sink->fd);
+
+    free(sink->frames);
+    sink->frames = NULL;
+}
@@ -0,0 +1,39 @@
+#ifndef FRAMESINK_H
+#define FRAMESINK_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+typedef enum
+{
+    SINK_Y4M,
+    SINK_RGBA
+} SinkFormat;
+
+#define SINK_BATCH 16
+
+typedef struct
+{
+    int fd;
+    SinkFormat format;
+    int scale;
+    int dedup;
+    size_t frame_size;
+    uint8_t *frames;
+    int slot;
+    int slots_queued;
+    char headers[SINK_BATCH][32];
+    struct iovec iov[SINK_BATCH * 2];
+    int iov_count;
+    uint64_t last[32];
+    int have_last;
+    uint64_t repeats;
+    uint64_t written;
+    uint64_t duplicates;
+} FrameSink;
+
+int open_frame_sink(FrameSink *sink, const char *path, SinkFormat format, int scale, int dedup);
+void write_frame(FrameSink *sink, const uint64_t *framebuffer);
+void close_frame_sink(FrameSink *sink);
+
+#endif
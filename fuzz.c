@@ -0,0 +1,522 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "chip8.h"
+#include "disasm.h"
+
+/*
+    chip8-fuzz: in-process, coverage-guided fuzzing of key sequences
+    against a fixed ROM, or of the ROM image itself (--rom-mode).
+
+    Every execution starts from a pristine Chip8 copied over the working
+    one, so nothing is re-read or re-initialised. Before each instruction
+    the harness checks for ROM bugs (stack over/underflow, memory and
+    keypad indices out of range, the PC leaving the ROM) and stops the
+    run there to report them as findings. The core itself only wraps
+    such indices and ignores a bad call or return, which keeps it safe
+    but hides the bug. Edges (previous PC, PC) index a coverage map.
+
+    Workers are forked processes sharing one anonymous mapping that holds
+    the coverage map, the corpus and the statistics. A worker only writes
+    to the shared map when it sees an edge for the first time, so once
+    coverage settles the workers run without sharing any cache lines.
+*/
+
+#define MAP_SIZE (1 << 16)
+#define CORPUS_CAPACITY 8192
+#define MAX_INPUT MAX_ROM_SIZE
+
+enum
+{
+    FAULT_NONE,
+    FAULT_PC,
+    FAULT_RUNAWAY,
+    FAULT_STACK_OVERFLOW,
+    FAULT_STACK_UNDERFLOW,
+    FAULT_MEMORY,
+    FAULT_KEY,
+    FAULT_OPCODE,
+    FAULT_KINDS
+};
+
+static const char *fault_names[FAULT_KINDS] = {
+    "none", "pc-out-of-range", "runaway-pc", "stack-overflow",
+    "stack-underflow", "memory-out-of-range", "key-out-of-range", "bad-opcode"
+};
+
+typedef struct
+{
+    uint32_t size;
+    uint32_t ready;
+    uint8_t data[MAX_INPUT];
+} CorpusEntry;
+
+typedef struct
+{
+    uint8_t coverage[MAP_SIZE];
+    uint8_t crash_seen[FAULT_KINDS][4096];
+    uint32_t corpus_count;
+    uint32_t stop;
+    uint64_t execs;
+    uint64_t crashes;
+    uint64_t unique_crashes;
+    uint64_t edges;
+    CorpusEntry corpus[CORPUS_CAPACITY];
+} Shared;
+
+typedef struct
+{
+    int rom_mode;
+    int frames;
+    uint16_t rom_end;
+    const char *out_dir;
+    Chip8 pristine;
+    Chip8 chip;
+    Shared *shared;
+    uint64_t rng;
+    int new_coverage;
+} Fuzzer;
+
+static uint64_t
+next_random(Fuzzer *fuzzer)
+{
+    uint64_t x = fuzzer->rng;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    fuzzer->rng = x;
+
+    return x;
+}
+
+static int
+check_fault(const Chip8 *chip, uint16_t rom_end)
+{
+    if(chip->pc > 4094)
+        return FAULT_PC;
+    if(chip->pc < START_LOCATION || chip->pc >= rom_end)
+        return FAULT_RUNAWAY;
+
+    uint16_t opcode = (chip->memory[chip->pc] << 8) | chip->memory[chip->pc + 1];
+    uint8_t x = (opcode & 0x0F00) >> 8;
+
+    if(!is_valid_opcode(opcode))
+        return FAULT_OPCODE;
+
+    switch(opcode >> 12)
+    {
+        case 0x0:
+            return (opcode == 0x00EE && chip->sp == 0) ? FAULT_STACK_UNDERFLOW : FAULT_NONE;
+        case 0x2:
+            return (chip->sp >= 16) ? FAULT_STACK_OVERFLOW : FAULT_NONE;
+        case 0xD:
+            return (chip->i + (opcode & 0xF) > 4096) ? FAULT_MEMORY : FAULT_NONE;
+        case 0xE:
+            return (chip->v[x] > 15) ? FAULT_KEY : FAULT_NONE;
+        case 0xF:
+            switch(opcode & 0xFF)
+            {
+                case 0x33: return (chip->i + 3 > 4096) ? FAULT_MEMORY : FAULT_NONE;
+                case 0x55:
+                case 0x65: return (chip->i + x + 1 > 4096) ? FAULT_MEMORY : FAULT_NONE;
+                default: return FAULT_NONE;
+            }
+        default:
+            return FAULT_NONE;
+    }
+}
+
+static void
+record_edge(Fuzzer *fuzzer, uint16_t from, uint16_t to)
+{
+    uint32_t edge = ((from * 0x9E37u) ^ to) & (MAP_SIZE - 1);
+    uint8_t *slot = &fuzzer->shared->coverage[edge];
+
+    if(__atomic_load_n(slot, __ATOMIC_RELAXED))
+        return;
+
+    if(!__atomic_exchange_n(slot, 1, __ATOMIC_RELAXED))
+    {
+        __atomic_fetch_add(&fuzzer->shared->edges, 1, __ATOMIC_RELAXED);
+        fuzzer->new_coverage = 1;
+    }
+}
+
+static int
+execute(Fuzzer *fuzzer, const uint8_t *data, size_t size, uint16_t *fault_pc)
+{
+    Chip8 *chip = &fuzzer->chip;
+    uint16_t rom_end = fuzzer->rom_end;
+
+    *chip = fuzzer->pristine;
+
+    if(fuzzer->rom_mode)
+    {
+        memcpy(&chip->memory[START_LOCATION], data, size);
+        rom_end = START_LOCATION + size;
+    }
+
+    for(int frame = 0; frame < fuzzer->frames; frame++)
+    {
+        if(!fuzzer->rom_mode)
+        {
+            uint16_t keys = (2 * frame + 1 < (int)size) ? data[2 * frame] | (data[2 * frame + 1] << 8) : 0;
+
+            for(int k = 0; k < 16; k++)
+                chip->keypad[k] = (keys >> k) & 1;
+        }
+
+        for(int n = 0; n < INSTRUCTIONS_PER_FRAME; n++)
+        {
+            int fault = check_fault(chip, rom_end);
+
+            if(fault)
+            {
+                *fault_pc = chip->pc;
+                return fault;
+            }
+
+            uint16_t from = chip->pc;
+
+            cycle(chip);
+            record_edge(fuzzer, from, chip->pc);
+        }
+
+        tick_timers(chip);
+    }
+
+    return FAULT_NONE;
+}
+
+static void
+add_to_corpus(Shared *shared, const uint8_t *data, size_t size)
+{
+    uint32_t index = __atomic_fetch_add(&shared->corpus_count, 1, __ATOMIC_RELAXED);
+
+    if(index >= CORPUS_CAPACITY)
+        return;
+
+    CorpusEntry *entry = &shared->corpus[index];
+
+    memcpy(entry->data, data, size);
+    entry->size = size;
+    __atomic_store_n(&entry->ready, 1, __ATOMIC_RELEASE);
+}
+
+static const CorpusEntry *
+pick_entry(Fuzzer *fuzzer)
+{
+    uint32_t count = __atomic_load_n(&fuzzer->shared->corpus_count, __ATOMIC_RELAXED);
+
+    if(count > CORPUS_CAPACITY)
+        count = CORPUS_CAPACITY;
+
+    for(;;)
+    {
+        const CorpusEntry *entry = &fuzzer->shared->corpus[next_random(fuzzer) % count];
+
+        if(__atomic_load_n(&entry->ready, __ATOMIC_ACQUIRE))
+            return entry;
+    }
+}
+
+static size_t
+mutate(Fuzzer *fuzzer, uint8_t *data, size_t size, size_t max_size)
+{
+    int rounds = 1 + next_random(fuzzer) % 4;
+
+    for(int r = 0; r < rounds && size; r++)
+    {
+        uint64_t rnd = next_random(fuzzer);
+        size_t pos = (rnd >> 8) % size;
+
+        switch(rnd % 6)
+        {
+            case 0:
+                data[pos] ^= 1 << ((rnd >> 32) % 8);
+                break;
+
+            case 1:
+                data[pos] = rnd >> 40;
+                break;
+
+            case 2:
+            {
+                // overwrite a run with a copy of another run
+                size_t from = (rnd >> 24) % size;
+                size_t len = 1 + (rnd >> 48) % 16;
+
+                if(pos + len > size)
+                    len = size - pos;
+                if(from + len > size)
+                    len = size - from;
+                memmove(&data[pos], &data[from], len);
+                break;
+            }
+
+            case 3:
+            {
+                const CorpusEntry *other = pick_entry(fuzzer);
+                size_t len = other->size - (other->size ? (rnd >> 24) % other->size : 0);
+
+                if(pos + len > max_size)
+                    len = max_size - pos;
+                memcpy(&data[pos], &other->data[other->size - len], len);
+                if(pos + len > size)
+                    size = pos + len;
+                break;
+            }
+
+            case 4:
+                if(size < max_size)
+                    data[size++] = rnd >> 40;
+                break;
+
+            default:
+                if(size > 2)
+                    size--;
+                break;
+        }
+    }
+
+    return size;
+}
+
+static void
+save_crash(Fuzzer *fuzzer, int fault, uint16_t pc, const uint8_t *data, size_t size)
+{
+    Shared *shared = fuzzer->shared;
+
+    __atomic_fetch_add(&shared->crashes, 1, __ATOMIC_RELAXED);
+
+    if(__atomic_exchange_n(&shared->crash_seen[fault][pc & 0xFFF], 1, __ATOMIC_RELAXED))
+        return;
+
+    __atomic_fetch_add(&shared->unique_crashes, 1, __ATOMIC_RELAXED);
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s-%03X.bin", fuzzer->out_dir, fault_names[fault], pc & 0xFFF);
+
+    FILE *output = fopen(path, "wb");
+
+    if(output)
+    {
+        fwrite(data, 1, size, output);
+        fclose(output);
+    }
+}
+
+static void
+run_worker(Fuzzer *fuzzer)
+{
+    Shared *shared = fuzzer->shared;
+    uint8_t data[MAX_INPUT];
+    size_t max_size = fuzzer->rom_mode ? MAX_INPUT : (size_t)fuzzer->frames * 2;
+    uint64_t local_execs = 0;
+
+    while(!__atomic_load_n(&shared->stop, __ATOMIC_RELAXED))
+    {
+        const CorpusEntry *entry = pick_entry(fuzzer);
+        size_t size = entry->size;
+        uint16_t fault_pc = 0;
+
+        memcpy(data, entry->data, size);
+        size = mutate(fuzzer, data, size, max_size);
+
+        fuzzer->new_coverage = 0;
+
+        int fault = execute(fuzzer, data, size, &fault_pc);
+
+        if(fault)
+            save_crash(fuzzer, fault, fault_pc, data, size);
+        else if(fuzzer->new_coverage)
+            add_to_corpus(shared, data, size);
+
+        // batch the shared counter update to keep it off the hot path
+        if(++local_execs == 1024)
+        {
+            __atomic_fetch_add(&shared->execs, local_execs, __ATOMIC_RELAXED);
+            local_execs = 0;
+        }
+    }
+}
+
+static void
+replay(Fuzzer *fuzzer, const uint8_t *data, size_t size)
+{
+    uint16_t pc = 0;
+    int fault = execute(fuzzer, data, size, &pc);
+
+    if(!fault)
+    {
+        printf("no fault after %d frames\n", fuzzer->frames);
+        return;
+    }
+
+    Chip8 *chip = &fuzzer->chip;
+    uint16_t opcode = (pc < 4095) ? (chip->memory[pc] << 8) | chip->memory[pc + 1] : 0;
+    char text[32];
+
+    disassemble(opcode, text, sizeof(text));
+    printf("%s at 0x%03X: %04X %s\n", fault_names[fault], pc, opcode, text);
+    printf("I=%03X SP=%X cycles=%llu\n", chip->i, chip->sp, (unsigned long long)chip->cycles);
+
+    for(int n = 0; n < 16; n++)
+        printf("V%X=%02X%s", n, chip->v[n], (n % 8 == 7) ? "\n" : " ");
+}
+
+static size_t
+read_file(const char *path, uint8_t *data, size_t size)
+{
+    FILE *input = fopen(path, "rb");
+
+    if(!input)
+    {
+        perror(path);
+        return 0;
+    }
+
+    size_t read = fread(data, 1, size, input);
+    fclose(input);
+
+    return read;
+}
+
+static void
+usage(char *name)
+{
+    fprintf(stderr, "usage: %s [options] rom\n"
+                    "  --rom-mode        mutate the ROM instead of the key sequence\n"
+                    "  --frames N        frames per execution (default 60)\n"
+                    "  --jobs N          worker processes (default: one per CPU)\n"
+                    "  --time S          stop after S seconds (default 10)\n"
+                    "  --out DIR         crash directory (default fuzz-out)\n"
+                    "  --replay FILE     run one saved input and describe its fault\n",
+            name);
+}
+
+int
+main(int argc, char **argv)
+{
+    static Fuzzer fuzzer;
+    int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int seconds = 10;
+    char *rom_path = NULL;
+    char *replay_path = NULL;
+
+    fuzzer.frames = 60;
+    fuzzer.out_dir = "fuzz-out";
+
+    for(int i = 1; i < argc; i++)
+    {
+        int has_value = i + 1 < argc;
+
+        if(strcmp(argv[i], "--rom-mode") == 0)
+            fuzzer.rom_mode = 1;
+        else if(strcmp(argv[i], "--frames") == 0 && has_value)
+            fuzzer.frames = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--jobs") == 0 && has_value)
+            jobs = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--time") == 0 && has_value)
+            seconds = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--out") == 0 && has_value)
+            fuzzer.out_dir = argv[++i];
+        else if(strcmp(argv[i], "--replay") == 0 && has_value)
+            replay_path = argv[++i];
+        else if(argv[i][0] != '-' && !rom_path)
+            rom_path = argv[i];
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if(!rom_path || fuzzer.frames < 1 || fuzzer.frames > MAX_INPUT / 2 || jobs < 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    uint8_t rom[MAX_ROM_SIZE];
+    size_t rom_size = read_file(rom_path, rom, sizeof(rom));
+
+    if(!rom_size)
+        return 1;
+
+    reset(&fuzzer.pristine, fuzzer.rom_mode ? NULL : rom, fuzzer.rom_mode ? 0 : rom_size);
+    fuzzer.rom_end = START_LOCATION + rom_size;
+
+    fuzzer.shared = mmap(NULL, sizeof(Shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if(fuzzer.shared == MAP_FAILED)
+    {
+        perror("shared memory could not be mapped");
+        return 1;
+    }
+
+    if(replay_path)
+    {
+        uint8_t data[MAX_INPUT];
+        size_t size = read_file(replay_path, data, sizeof(data));
+
+        replay(&fuzzer, data, size);
+        return 0;
+    }
+
+    mkdir(fuzzer.out_dir, 0755);
+
+    if(fuzzer.rom_mode)
+        add_to_corpus(fuzzer.shared, rom, rom_size);
+    else
+    {
+        uint8_t idle[MAX_INPUT] = { 0 };
+        add_to_corpus(fuzzer.shared, idle, fuzzer.frames * 2);
+    }
+
+    for(int job = 0; job < jobs; job++)
+    {
+        if(fork() == 0)
+        {
+            fuzzer.rng = ((uint64_t)getpid() << 32) ^ (uint64_t)time(NULL) ^ 0x9E3779B97F4A7C15ull;
+            run_worker(&fuzzer);
+            _exit(0);
+        }
+    }
+
+    Shared *shared = fuzzer.shared;
+    uint64_t last_execs = 0;
+
+    for(int second = 1; second <= seconds; second++)
+    {
+        sleep(1);
+
+        uint64_t execs = __atomic_load_n(&shared->execs, __ATOMIC_RELAXED);
+        uint32_t corpus = __atomic_load_n(&shared->corpus_count, __ATOMIC_RELAXED);
+
+        printf("[%3ds] %llu execs (%llu/s), corpus %u, edges %llu, crashes %llu (%llu unique)\n", second,
+               (unsigned long long)execs, (unsigned long long)(execs - last_execs),
+               corpus < CORPUS_CAPACITY ? corpus : CORPUS_CAPACITY,
+               (unsigned long long)shared->edges, (unsigned long long)shared->crashes,
+               (unsigned long long)shared->unique_crashes);
+        fflush(stdout);
+
+        last_execs = execs;
+    }
+
+    __atomic_store_n(&shared->stop, 1, __ATOMIC_RELAXED);
+
+    while(wait(NULL) > 0)
+        ;
+
+    return 0;
+}
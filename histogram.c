@@ -0,0 +1,106 @@
+#include <math.h>
+#include <string.h>
+#include "histogram.h"
+
+#define BAR_WIDTH 40
+
+int
+histogram_bucket(uint32_t value)
+{
+    if(value < HISTOGRAM_SUB)
+        return value;
+
+    int exponent = 31 - __builtin_clz(value);
+    int sub = (value >> (exponent - 3)) & (HISTOGRAM_SUB - 1);
+
+    return (exponent - 2) * HISTOGRAM_SUB + sub;
+}
+
+uint32_t
+histogram_bucket_floor(int index)
+{
+    if(index < HISTOGRAM_SUB)
+        return index;
+
+    int exponent = index / HISTOGRAM_SUB + 2;
+    int sub = index % HISTOGRAM_SUB;
+
+    return (uint32_t)(HISTOGRAM_SUB + sub) << (exponent - 3);
+}
+
+void
+init_histogram(Histogram *histogram)
+{
+    memset(histogram, 0, sizeof(*histogram));
+    histogram->min = UINT32_MAX;
+}
+
+void
+record_histogram(Histogram *histogram, uint32_t value)
+{
+    histogram->buckets[histogram_bucket(value)]++;
+    histogram->count++;
+    histogram->sum += value;
+    histogram->sum_squares += (double)value * value;
+
+    if(value < histogram->min)
+        histogram->min = value;
+    if(value > histogram->max)
+        histogram->max = value;
+}
+
+uint32_t
+histogram_percentile(const Histogram *histogram, double percentile)
+{
+    uint64_t rank = (uint64_t)ceil(histogram->count * percentile / 100.0);
+    uint64_t seen = 0;
+
+    if(rank == 0)
+        rank = 1;
+
+    for(int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += histogram->buckets[i];
+
+        if(seen >= rank)
+            return histogram_bucket_floor(i);
+    }
+
+    return histogram->max;
+}
+
+void
+print_histogram(const Histogram *histogram, const char *name, FILE *out)
+{
+    if(!histogram->count)
+        return;
+
+    double mean = (double)histogram->sum / histogram->count;
+    double variance = histogram->sum_squares / histogram->count - mean * mean;
+
+    fprintf(out, "%s: %llu samples, min %u / avg %.0f / p50 %u / p99 %u / max %u us, stddev %.0f us\n",
+            name, (unsigned long long)histogram->count, histogram->min, mean,
+            histogram_percentile(histogram, 50), histogram_percentile(histogram, 99),
+            histogram->max, variance > 0 ? sqrt(variance) : 0);
+
+    uint64_t peak = 0;
+
+    for(int i = 0; i < HISTOGRAM_BUCKETS; i++)
+        if(histogram->buckets[i] > peak)
+            peak = histogram->buckets[i];
+
+    for(int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        if(!histogram->buckets[i])
+            continue;
+
+        int width = (int)(histogram->buckets[i] * BAR_WIDTH / peak);
+        char bar[BAR_WIDTH + 1];
+
+        memset(bar, '#', width ? width : 1);
+        bar[width ? width : 1] = '\0';
+
+        fprintf(out, "  %8u us %8llu %s\n", histogram_bucket_floor(i),
+                (unsigned long long)histogram->buckets[i], bar);
+    }
+}
@@ -0,0 +1,112 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "image.h"
+#include "chip8.h"
+
+/*
+    Published images live in an open-addressed table keyed by a hash of
+    the ROM, twice the size of the cache so a probe always ends at an
+    empty slot. Slots are only ever filled, never cleared, so lookups
+    read them without the lock; the lock only serialises building.
+*/
+
+#define IMAGE_SLOTS (IMAGE_CACHE * 2)
+
+static _Atomic(const RomImage *) slots[IMAGE_SLOTS];
+static atomic_int image_count;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+// batches reset many instances with one ROM in a row; skip the lookup for those
+static _Thread_local const RomImage *last_image;
+
+static int
+image_matches(const RomImage *image, const uint8_t *rom, size_t size)
+{
+    return image->size == size && (size == 0 || memcmp(&image->memory[START_LOCATION], rom, size) == 0);
+}
+
+// FNV-1a over 8-byte words, enough to spread ROMs over the table
+static uint64_t
+image_key(const uint8_t *rom, size_t size)
+{
+    uint64_t hash = 0xCBF29CE484222325ull ^ size;
+    size_t n = 0;
+
+    for(; n + 8 <= size; n += 8)
+    {
+        uint64_t word;
+
+        memcpy(&word, rom + n, 8);
+        hash = (hash ^ word) * 0x100000001B3ull;
+    }
+
+    for(; n < size; n++)
+        hash = (hash ^ rom[n]) * 0x100000001B3ull;
+
+    return hash ^ (hash >> 32);
+}
+
+static const RomImage *
+find_image(uint64_t key, const uint8_t *rom, size_t size)
+{
+    for(size_t n = key; ; n++)
+    {
+        const RomImage *image = atomic_load_explicit(&slots[n % IMAGE_SLOTS], memory_order_acquire);
+
+        if(!image)
+            return NULL;
+        if(image->key == key && image_matches(image, rom, size))
+            return image;
+    }
+}
+
+const RomImage *
+shared_image(const uint8_t *rom, size_t size)
+{
+    const RomImage *image = last_image;
+
+    if(image && image_matches(image, rom, size))
+        return image;
+
+    uint64_t key = image_key(rom, size);
+
+    image = find_image(key, rom, size);
+
+    // once the cache is full a miss stays a miss, without taking the lock
+    if(!image && atomic_load_explicit(&image_count, memory_order_relaxed) < IMAGE_CACHE)
+    {
+        pthread_mutex_lock(&lock);
+
+        image = find_image(key, rom, size);
+
+        if(!image && atomic_load_explicit(&image_count, memory_order_relaxed) < IMAGE_CACHE)
+        {
+            RomImage *built = malloc(sizeof(*built));
+
+            if(built)
+            {
+                size_t n = key;
+
+                built->size = size;
+                built->key = key;
+                built->hash = load_image(built->memory, rom, size);
+
+                while(atomic_load_explicit(&slots[n % IMAGE_SLOTS], memory_order_relaxed))
+                    n++;
+
+                atomic_store_explicit(&slots[n % IMAGE_SLOTS], built, memory_order_release);
+                atomic_fetch_add_explicit(&image_count, 1, memory_order_relaxed);
+                image = built;
+            }
+        }
+
+        pthread_mutex_unlock(&lock);
+    }
+
+    if(image)
+        last_image = image;
+
+    return image;
+}
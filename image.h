@@ -0,0 +1,31 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    Pristine memory images, built once per ROM and shared read-only by
+    every instance reset with that ROM, on any thread. An image is the
+    font and ROM laid out in memory together with its state hash, so a
+    reset is a 4 KiB copy instead of a rebuild and a full rehash.
+
+    Images are never modified or freed once published. After
+    IMAGE_CACHE distinct ROMs, further ones are simply not cached and
+    reset() builds their memory directly as before; finding out costs
+    one hash of the ROM and a lock-free table probe.
+*/
+
+#define IMAGE_CACHE 64
+
+typedef struct
+{
+    size_t size;
+    uint64_t key;
+    uint64_t hash;
+    uint8_t memory[4096];
+} RomImage;
+
+const RomImage *shared_image(const uint8_t *rom, size_t size);
+
+#endif
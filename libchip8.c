@@ -0,0 +1,62 @@
+#include <stdlib.h>
+#include "libchip8.h"
+#include "arena.h"
+
+// cache line aligned so the hot registers share a single line
+Chip8 *
+chip8_create(void)
+{
+    Chip8 *chip = aligned_alloc(64, INSTANCE_STRIDE);
+
+    if(chip)
+        reset(chip, NULL, 0);
+
+    return chip;
+}
+
+void
+chip8_destroy(Chip8 *chip)
+{
+    free(chip);
+}
+
+void
+chip8_reset(Chip8 *chip, const uint8_t *rom, size_t size, uint32_t seed)
+{
+    reset(chip, rom, size);
+    seed_random(chip, seed);
+}
+
+void
+chip8_step_frames(Chip8 *chip, int frames, uint16_t keys)
+{
+    for(int k = 0; k < 16; k++)
+        chip->keypad[k] = (keys >> k) & 1;
+
+    for(int n = 0; n < frames; n++)
+        step_frame(chip);
+}
+
+const uint64_t *
+chip8_framebuffer(const Chip8 *chip)
+{
+    return chip->framebuffer;
+}
+
+uint8_t *
+chip8_memory(Chip8 *chip)
+{
+    return chip->memory;
+}
+
+uint64_t
+chip8_state_hash(const Chip8 *chip)
+{
+    return state_hash(chip);
+}
+
+void
+chip8_rehash(Chip8 *chip)
+{
+    rehash(chip);
+}
@@ -0,0 +1,36 @@
+#ifndef LIBCHIP8_H
+#define LIBCHIP8_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "chip8.h"
+
+/*
+    Embedding API. Instances share no state, so any number of them can
+    be stepped from any number of threads as long as each instance is
+    used by one thread at a time. Only chip8_create() allocates, apart
+    from chip8_reset() building the shared image of a ROM it has not
+    seen before (see image.h). The core prints nothing; unknown opcodes
+    are skipped and counted in unknown_opcodes for the caller to report.
+
+    The library is built with hidden visibility, so libchip8.so exports
+    only the functions below; everything else is internal.
+*/
+
+#define CHIP8_API __attribute__((visibility("default")))
+
+CHIP8_API Chip8 *chip8_create(void);
+CHIP8_API void chip8_destroy(Chip8 *chip);
+CHIP8_API void chip8_reset(Chip8 *chip, const uint8_t *rom, size_t size, uint32_t seed);
+CHIP8_API void chip8_step_frames(Chip8 *chip, int frames, uint16_t keys);
+
+// 32 rows, bit 63 is the leftmost pixel; valid for the life of the instance
+CHIP8_API const uint64_t *chip8_framebuffer(const Chip8 *chip);
+// writes through this pointer must be followed by chip8_rehash()
+CHIP8_API uint8_t *chip8_memory(Chip8 *chip);
+
+// incrementally maintained, a few nanoseconds per call
+CHIP8_API uint64_t chip8_state_hash(const Chip8 *chip);
+CHIP8_API void chip8_rehash(Chip8 *chip);
+
+#endif
@@ -0,0 +1,171 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "client.h"
+#include "chip8.h"
+
+/*
+    chip8-load: opens a set of sessions on chip8d, loads the same ROM
+    into each and then issues rounds of one batched message that steps
+    every session. Reports round-trip latency percentiles and the
+    per-command cost.
+*/
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int
+compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void
+usage(char *name)
+{
+    fprintf(stderr, "usage: %s [--socket PATH] [--sessions N] [--rounds N] [--frames N] rom\n", name);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *path = DEFAULT_SOCKET_PATH;
+    int sessions = 64;
+    int rounds = 1000;
+    int frames = 1;
+    char *rom_path = NULL;
+
+    for(int i = 1; i < argc; i++)
+    {
+        int has_value = i + 1 < argc;
+
+        if(strcmp(argv[i], "--socket") == 0 && has_value)
+            path = argv[++i];
+        else if(strcmp(argv[i], "--sessions") == 0 && has_value)
+            sessions = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--rounds") == 0 && has_value)
+            rounds = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--frames") == 0 && has_value)
+            frames = atoi(argv[++i]);
+        else if(argv[i][0] != '-' && !rom_path)
+            rom_path = argv[i];
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if(!rom_path || sessions < 1 || sessions > MAX_SESSIONS || rounds < 1 || frames < 1 || frames > MAX_FRAMES)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    uint8_t rom[MAX_ROM_SIZE];
+    FILE *input = fopen(rom_path, "rb");
+
+    if(!input)
+    {
+        perror("could not open rom");
+        return 1;
+    }
+
+    size_t rom_size = fread(rom, 1, sizeof(rom), input);
+    fclose(input);
+
+    Chip8Client client;
+
+    if(client_connect(&client, path))
+        return 1;
+
+    uint16_t *ids = malloc(sessions * sizeof(uint16_t));
+    uint64_t *latency = malloc(rounds * sizeof(uint64_t));
+    ClientResult result;
+
+    client_begin(&client);
+    for(int s = 0; s < sessions; s++)
+        client_add(&client, OP_CREATE, 0, 0, NULL);
+    if(client_send(&client) != sessions)
+        return 1;
+
+    for(int s = 0; s < sessions && client_next(&client, &result); s++)
+    {
+        if(result.status != STATUS_OK)
+        {
+            fprintf(stderr, "session %d could not be created\n", s);
+            return 1;
+        }
+        ids[s] = result.session;
+    }
+
+    client_begin(&client);
+    for(int s = 0; s < sessions; s++)
+        client_add(&client, OP_LOAD, ids[s], rom_size, rom);
+    if(client_send(&client) != sessions)
+        return 1;
+
+    for(int s = 0; s < sessions; s++)
+    {
+        if(!client_next(&client, &result) || result.status != STATUS_OK)
+        {
+            fprintf(stderr, "session %d could not load the rom\n", s);
+            return 1;
+        }
+    }
+
+    uint64_t start = now_ns();
+
+    for(int r = 0; r < rounds; r++)
+    {
+        uint64_t round_start = now_ns();
+
+        client_begin(&client);
+        for(int s = 0; s < sessions; s++)
+            client_add(&client, OP_FRAMES, ids[s], frames, NULL);
+
+        if(client_send(&client) != sessions)
+        {
+            fprintf(stderr, "round %d failed\n", r);
+            return 1;
+        }
+
+        latency[r] = now_ns() - round_start;
+    }
+
+    uint64_t elapsed = now_ns() - start;
+
+    client_begin(&client);
+    for(int s = 0; s < sessions; s++)
+        client_add(&client, OP_DESTROY, ids[s], 0, NULL);
+    client_send(&client);
+    client_close(&client);
+
+    qsort(latency, rounds, sizeof(uint64_t), compare_u64);
+
+    double commands = (double)rounds * sessions;
+
+    printf("%d sessions x %d rounds x %d frames\n", sessions, rounds, frames);
+    printf("round trip: p50 %.1f us, p99 %.1f us, max %.1f us\n",
+           latency[rounds / 2] / 1e3, latency[rounds * 99 / 100] / 1e3, latency[rounds - 1] / 1e3);
+    printf("per command: %.3f us, %.0f session-frames/s\n",
+           elapsed / 1e3 / commands, commands * frames / (elapsed / 1e9));
+
+    free(ids);
+    free(latency);
+
+    return 0;
+}
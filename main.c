@@ -1,17 +1,198 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include "emulator.h"
+#include "monitor.h"
 
-int main(int argc, char **argv)
+static void
+usage(char *name)
 {
-    if(argc != 2)
+    fprintf(stderr, "usage: %s [options] rom\n"
+                    "  --headless        run without a window and without frame pacing\n"
+                    "  --frames N        stop after N frames\n"
+                    "  --y4m FILE        stream frames as Y4M (- for stdout)\n"
+                    "  --rgba FILE       stream frames as raw RGBA (- for stdout)\n"
+                    "  --scale N         frame stream scale factor (default 1)\n"
+                    "  --dedup           drop identical Y4M frames, marking them with XDUP\n"
+                    "  --debug           start in the debugger; Ctrl-C breaks back into it\n"
+                    "  --break ADDR      break at hex address ADDR (repeatable)\n"
+                    "  --pace MODE       frame pacing: timer (default), vsync or audio\n"
+                    "  --metrics FILE    export Prometheus text metrics to FILE\n"
+                    "  --metrics-json    append JSON lines to the metrics file instead\n"
+                    "  --metrics-ms MS   metrics export period (default 1000)\n"
+                    "  --pin ADDR=VALUE  hold hex address ADDR at VALUE every frame (repeatable)\n"
+                    "  --runahead N      show the frame N frames ahead (0-8, default from ROM.cfg or 0)\n"
+                    "  --netplay SPEC    rollback netplay, SPEC is LOCALPORT:HOST:PORT of the peer\n"
+                    "  --net-keys MASK   hex mask of the keys this peer owns (default 00FF on the\n"
+                    "                    lower port, FF00 on the higher; the peers' masks must not overlap)\n"
+                    "  --net-sim D,J,L   simulate D ms delay, J ms jitter and L%% loss on sends\n"
+                    "  --net-window N    frames to predict past the peer's input (default 8)\n"
+                    "  --trace FILE      record a binary execution trace (see chip8-trace)\n"
+                    "  --monitor N       run N instances with random input, tiled in one window\n"
+                    "  --threads N       monitor worker threads (default: one per core, less one)\n",
+            name);
+}
+
+int
+main(int argc, char **argv)
+{
+    EmulatorOptions options = { 0 };
+    MonitorOptions monitor = { 0 };
+    options.sink_scale = 1;
+    options.runahead = -1;
+    options.netplay.seed = 1;
+    int net_keys = -1;
+
+    for(int i = 1; i < argc; i++)
+    {
+        char *arg = argv[i];
+        int has_value = i + 1 < argc;
+
+        if(strcmp(arg, "--headless") == 0)
+            options.headless = 1;
+        else if(strcmp(arg, "--frames") == 0 && has_value)
+            options.frames = atol(argv[++i]);
+        else if(strcmp(arg, "--y4m") == 0 && has_value)
+        {
+            options.sink_path = argv[++i];
+            options.sink_format = SINK_Y4M;
+        }
+        else if(strcmp(arg, "--rgba") == 0 && has_value)
+        {
+            options.sink_path = argv[++i];
+            options.sink_format = SINK_RGBA;
+        }
+        else if(strcmp(arg, "--scale") == 0 && has_value)
+            options.sink_scale = atoi(argv[++i]);
+        else if(strcmp(arg, "--dedup") == 0)
+            options.sink_dedup = 1;
+        else if(strcmp(arg, "--debug") == 0)
+            options.debug = 1;
+        else if(strcmp(arg, "--break") == 0 && has_value && options.breakpoint_count < 16)
+            options.breakpoints[options.breakpoint_count++] = (uint16_t)strtol(argv[++i], NULL, 16);
+        else if(strcmp(arg, "--pace") == 0 && has_value)
+        {
+            char *mode = argv[++i];
+
+            if(strcmp(mode, "timer") == 0)
+                options.pace = PACE_TIMER;
+            else if(strcmp(mode, "vsync") == 0)
+                options.pace = PACE_VSYNC;
+            else if(strcmp(mode, "audio") == 0)
+                options.pace = PACE_AUDIO;
+            else
+            {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if(strcmp(arg, "--metrics") == 0 && has_value)
+            options.metrics_path = argv[++i];
+        else if(strcmp(arg, "--metrics-json") == 0)
+            options.metrics_format = METRICS_JSON;
+        else if(strcmp(arg, "--metrics-ms") == 0 && has_value)
+            options.metrics_interval = atoi(argv[++i]);
+        else if(strcmp(arg, "--pin") == 0 && has_value && strchr(argv[i + 1], '='))
+        {
+            char *value = strchr(argv[++i], '=') + 1;
+
+            if(pin_address(&options.pins, (uint16_t)strtol(argv[i], NULL, 16), (uint8_t)strtol(value, NULL, 0)))
+            {
+                fprintf(stderr, "at most %d pins\n", RAM_PINS);
+                return 1;
+            }
+        }
+        else if(strcmp(arg, "--runahead") == 0 && has_value)
+            options.runahead = atoi(argv[++i]);
+        else if(strcmp(arg, "--netplay") == 0 && has_value && strchr(argv[i + 1], ':'))
+        {
+            options.netplay.local_port = atoi(argv[++i]);
+            options.netplay.peer = strchr(argv[i], ':') + 1;
+        }
+        else if(strcmp(arg, "--net-keys") == 0 && has_value)
+            net_keys = (uint16_t)strtol(argv[++i], NULL, 16);
+        else if(strcmp(arg, "--net-sim") == 0 && has_value)
+        {
+            NetplayOptions *net = &options.netplay;
+
+            if(sscanf(argv[++i], "%d,%d,%d", &net->delay_ms, &net->jitter_ms, &net->loss_percent) != 3 ||
+               net->delay_ms < 0 || net->jitter_ms < 0 || net->loss_percent < 0 || net->loss_percent > 100)
+            {
+                fprintf(stderr, "--net-sim takes DELAY_MS,JITTER_MS,LOSS_PERCENT, with loss 0 to 100\n");
+                return 1;
+            }
+        }
+        else if(strcmp(arg, "--net-window") == 0 && has_value)
+            options.netplay.max_prediction = atoi(argv[++i]);
+        else if(strcmp(arg, "--trace") == 0 && has_value)
+            options.trace_path = argv[++i];
+        else if(strcmp(arg, "--monitor") == 0 && has_value)
+            monitor.instances = atoi(argv[++i]);
+        else if(strcmp(arg, "--threads") == 0 && has_value)
+            monitor.threads = atoi(argv[++i]);
+        else if(arg[0] != '-' && !options.rom)
+            options.rom = arg;
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if(!options.rom || options.sink_scale < 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // netplay steps whole frames itself, bypassing the debugger, the trace and the pins
+    if(options.netplay.peer && (options.debug || options.breakpoint_count || options.trace_path || options.pins.count))
+    {
+        fprintf(stderr, "--netplay cannot be combined with --debug, --break, --trace or --pin\n");
         return 1;
+    }
 
-    Emulator emulator;
+    // without --net-keys the peers split the keypad by port, so both ends agree without talking
+    if(options.netplay.peer && net_keys < 0)
+    {
+        const char *colon = strrchr(options.netplay.peer, ':');
+        int peer_port = colon ? atoi(colon + 1) : 0;
+
+        if(peer_port == options.netplay.local_port)
+        {
+            fprintf(stderr, "both netplay ports are %d, so --net-keys is needed to split the keypad\n", peer_port);
+            return 1;
+        }
+
+        net_keys = options.netplay.local_port < peer_port ? 0x00FF : 0xFF00;
+    }
+
+    options.netplay.keys = net_keys < 0 ? 0 : net_keys;
+
+    if(monitor.instances > 0)
+    {
+        monitor.rom = options.rom;
+        monitor.frames = options.frames;
+
+        if(options.metrics_path &&
+           start_metrics_export(options.metrics_path, options.metrics_format, options.metrics_interval))
+            return 1;
+
+        int status = run_monitor(&monitor);
+
+        if(options.metrics_path)
+            stop_metrics_export();
+
+        return status ? 1 : 0;
+    }
+
+    static Emulator emulator;
     
-    init_emulator(&emulator, argv[1]);
+    if(init_emulator(&emulator, &options))
+        return 1;
 
     run_emulator(&emulator);
     
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,340 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "metrics.h"
+
+/*
+    Prometheus buckets are emitted only at powers of two, so a scrape
+    stays around thirty lines per histogram; the JSON lines carry
+    percentiles taken from the full-resolution buckets instead.
+*/
+
+#define PROMETHEUS_BUCKETS 26
+
+_Thread_local MetricsShard *metrics_shard;
+
+static _Atomic(MetricsShard *) shards;
+
+typedef struct
+{
+    uint64_t counters[METRIC_COUNTERS];
+    Histogram histograms[METRIC_HISTOGRAMS];
+    double time;
+} MetricsSnapshot;
+
+static struct
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int running;
+    int stop;
+    char *path;
+    MetricsFormat format;
+    int interval_ms;
+    FILE *json;
+    MetricsSnapshot last;
+} exporter = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+// Prometheus name, and whether the counter holds nanoseconds to export as seconds
+static const struct
+{
+    const char *name;
+    int nanoseconds;
+} counter_names[METRIC_COUNTERS] =
+{
+    [METRIC_INSTRUCTIONS]     = { "instructions", 0 },
+    [METRIC_FRAMES_EMULATED]  = { "frames_emulated", 0 },
+    [METRIC_FRAMES_PRESENTED] = { "frames_presented", 0 },
+    [METRIC_DRAWS]            = { "draws", 0 },
+    [METRIC_UNKNOWN_OPCODES]  = { "unknown_opcodes", 0 },
+    [METRIC_CYCLE_NS]         = { "cycle_seconds", 1 },
+    [METRIC_INPUT_NS]         = { "input_seconds", 1 },
+    [METRIC_RENDER_NS]        = { "render_seconds", 1 },
+    [METRIC_RUNAHEAD_NS]      = { "runahead_seconds", 1 },
+};
+
+static const char *histogram_names[METRIC_HISTOGRAMS] =
+{
+    [METRIC_FRAME_TIME]      = "frame_time",
+    [METRIC_SLEEP_OVERSHOOT] = "sleep_overshoot",
+};
+
+MetricsShard *
+register_metrics_shard(void)
+{
+    MetricsShard *shard = calloc(1, sizeof(*shard));
+
+    if(!shard)
+        return NULL;
+
+    shard->next = atomic_load(&shards);
+
+    while(!atomic_compare_exchange_weak(&shards, &shard->next, shard))
+        ;
+
+    metrics_shard = shard;
+
+    return shard;
+}
+
+static void
+take_snapshot(MetricsSnapshot *snapshot)
+{
+    struct timespec now;
+
+    memset(snapshot, 0, sizeof(*snapshot));
+    clock_gettime(CLOCK_REALTIME, &now);
+    snapshot->time = now.tv_sec + now.tv_nsec / 1e9;
+
+    for(MetricsShard *shard = atomic_load(&shards); shard; shard = shard->next)
+    {
+        for(int c = 0; c < METRIC_COUNTERS; c++)
+            snapshot->counters[c] += atomic_load_explicit(&shard->counters[c], memory_order_relaxed);
+
+        for(int h = 0; h < METRIC_HISTOGRAMS; h++)
+        {
+            Histogram *histogram = &snapshot->histograms[h];
+
+            for(int b = 0; b < HISTOGRAM_BUCKETS; b++)
+            {
+                uint64_t count = atomic_load_explicit(&shard->buckets[h][b], memory_order_relaxed);
+
+                histogram->buckets[b] += count;
+                histogram->count += count;
+            }
+
+            histogram->sum += atomic_load_explicit(&shard->sums[h], memory_order_relaxed);
+        }
+    }
+}
+
+static void
+write_prometheus(const MetricsSnapshot *snapshot)
+{
+    char tmp[4096];
+
+    // written aside and renamed over, so a scraper never sees half a file
+    snprintf(tmp, sizeof(tmp), "%s.tmp", exporter.path);
+
+    FILE *out = fopen(tmp, "w");
+
+    if(!out)
+    {
+        perror("could not write metrics");
+        return;
+    }
+
+    for(int c = 0; c < METRIC_COUNTERS; c++)
+    {
+        fprintf(out, "# TYPE chip8_%s_total counter\n", counter_names[c].name);
+
+        if(counter_names[c].nanoseconds)
+            fprintf(out, "chip8_%s_total %.9f\n", counter_names[c].name, snapshot->counters[c] / 1e9);
+        else
+            fprintf(out, "chip8_%s_total %llu\n", counter_names[c].name,
+                    (unsigned long long)snapshot->counters[c]);
+    }
+
+    for(int h = 0; h < METRIC_HISTOGRAMS; h++)
+    {
+        const Histogram *histogram = &snapshot->histograms[h];
+        const char *name = histogram_names[h];
+        uint64_t cumulative = 0;
+        int b = 0;
+
+        fprintf(out, "# TYPE chip8_%s_seconds histogram\n", name);
+
+        for(int i = 0; i < PROMETHEUS_BUCKETS; i++)
+        {
+            uint32_t bound = (uint32_t)1 << i;
+
+            // le means at most, so a bucket counts once the largest value it can hold is within bound
+            for(; b + 1 < HISTOGRAM_BUCKETS && histogram_bucket_floor(b + 1) - 1 <= bound; b++)
+                cumulative += histogram->buckets[b];
+
+            fprintf(out, "chip8_%s_seconds_bucket{le=\"%g\"} %llu\n", name, bound / 1e6,
+                    (unsigned long long)cumulative);
+        }
+
+        fprintf(out, "chip8_%s_seconds_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)histogram->count);
+        fprintf(out, "chip8_%s_seconds_sum %.6f\n", name, histogram->sum / 1e6);
+        fprintf(out, "chip8_%s_seconds_count %llu\n", name, (unsigned long long)histogram->count);
+    }
+
+    if(fclose(out) || rename(tmp, exporter.path))
+        perror("could not write metrics");
+}
+
+/*
+    One line per interval. Rates and percentiles cover just that
+    interval, taken from the difference against the previous snapshot.
+*/
+
+static void
+write_json(const MetricsSnapshot *snapshot, const MetricsSnapshot *last)
+{
+    uint64_t delta[METRIC_COUNTERS];
+    double elapsed = snapshot->time - last->time;
+
+    if(elapsed <= 0)
+        elapsed = 1e-9;
+
+    for(int c = 0; c < METRIC_COUNTERS; c++)
+        delta[c] = snapshot->counters[c] - last->counters[c];
+
+    fprintf(exporter.json, "{\"time\":%.3f,\"interval\":%.3f,\"instructions_per_second\":%.0f,"
+                           "\"draws_per_second\":%.0f,\"frames_emulated\":%llu,\"frames_presented\":%llu,"
+                           "\"unknown_opcodes\":%llu,\"cycle_ms\":%.3f,\"input_ms\":%.3f,\"render_ms\":%.3f,"
+                           "\"runahead_ms\":%.3f",
+            snapshot->time, elapsed,
+            delta[METRIC_INSTRUCTIONS] / elapsed,
+            delta[METRIC_DRAWS] / elapsed,
+            (unsigned long long)delta[METRIC_FRAMES_EMULATED],
+            (unsigned long long)delta[METRIC_FRAMES_PRESENTED],
+            (unsigned long long)delta[METRIC_UNKNOWN_OPCODES],
+            delta[METRIC_CYCLE_NS] / 1e6,
+            delta[METRIC_INPUT_NS] / 1e6,
+            delta[METRIC_RENDER_NS] / 1e6,
+            delta[METRIC_RUNAHEAD_NS] / 1e6);
+
+    for(int h = 0; h < METRIC_HISTOGRAMS; h++)
+    {
+        Histogram interval;
+
+        init_histogram(&interval);
+
+        for(int b = 0; b < HISTOGRAM_BUCKETS; b++)
+            interval.buckets[b] = snapshot->histograms[h].buckets[b] - last->histograms[h].buckets[b];
+
+        interval.count = snapshot->histograms[h].count - last->histograms[h].count;
+        interval.max = 0;
+
+        if(interval.count)
+            fprintf(exporter.json, ",\"%s_p50_us\":%u,\"%s_p99_us\":%u",
+                    histogram_names[h], histogram_percentile(&interval, 50),
+                    histogram_names[h], histogram_percentile(&interval, 99));
+    }
+
+    fprintf(exporter.json, "}\n");
+    fflush(exporter.json);
+}
+
+static void
+export_metrics(void)
+{
+    MetricsSnapshot snapshot;
+
+    take_snapshot(&snapshot);
+
+    if(exporter.format == METRICS_PROMETHEUS)
+        write_prometheus(&snapshot);
+    else
+        write_json(&snapshot, &exporter.last);
+
+    exporter.last = snapshot;
+}
+
+static void *
+export_loop(void *arg)
+{
+    struct timespec deadline;
+
+    (void)arg;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    pthread_mutex_lock(&exporter.lock);
+
+    while(!exporter.stop)
+    {
+        deadline.tv_sec += exporter.interval_ms / 1000;
+        deadline.tv_nsec += (exporter.interval_ms % 1000) * 1000000L;
+
+        if(deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        while(!exporter.stop && pthread_cond_timedwait(&exporter.wake, &exporter.lock, &deadline) == 0)
+            ;
+
+        pthread_mutex_unlock(&exporter.lock);
+        export_metrics();
+        pthread_mutex_lock(&exporter.lock);
+    }
+
+    pthread_mutex_unlock(&exporter.lock);
+
+    return NULL;
+}
+
+int
+start_metrics_export(const char *path, MetricsFormat format, int interval_ms)
+{
+    pthread_condattr_t attr;
+
+    exporter.path = strdup(path);
+    exporter.format = format;
+    exporter.interval_ms = interval_ms > 0 ? interval_ms : 1000;
+    exporter.stop = 0;
+    exporter.json = NULL;
+
+    if(!exporter.path)
+        return -1;
+
+    if(format == METRICS_JSON && !(exporter.json = fopen(path, "a")))
+    {
+        perror("could not open metrics file");
+        free(exporter.path);
+        return -1;
+    }
+
+    take_snapshot(&exporter.last);
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&exporter.wake, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if(pthread_create(&exporter.thread, NULL, export_loop, NULL))
+    {
+        perror("could not start metrics export");
+        pthread_cond_destroy(&exporter.wake);
+        if(exporter.json)
+            fclose(exporter.json);
+        free(exporter.path);
+        return -1;
+    }
+
+    exporter.running = 1;
+
+    return 0;
+}
+
+/*
+    Wakes the exporter for one last export, so counts from the final
+    partial interval are not lost, and waits for it to finish.
+*/
+
+void
+stop_metrics_export(void)
+{
+    if(!exporter.running)
+        return;
+
+    pthread_mutex_lock(&exporter.lock);
+    exporter.stop = 1;
+    pthread_cond_signal(&exporter.wake);
+    pthread_mutex_unlock(&exporter.lock);
+    pthread_join(exporter.thread, NULL);
+
+    pthread_cond_destroy(&exporter.wake);
+    if(exporter.json)
+        fclose(exporter.json);
+    free(exporter.path);
+    exporter.running = 0;
+}
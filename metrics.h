@@ -0,0 +1,87 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "histogram.h"
+
+/*
+    Process-wide counters and histograms, cheap enough to leave on.
+    Every thread writes only its own shard, allocated on first use and
+    linked into a global list, so an update is a relaxed load and store
+    with no locked instruction and no shared cache line. The exporter
+    thread sums the shards; a shard outlives its thread so nothing it
+    counted is lost. Histogram values are microseconds.
+*/
+
+typedef enum
+{
+    METRIC_INSTRUCTIONS,
+    METRIC_FRAMES_EMULATED,
+    METRIC_FRAMES_PRESENTED,
+    METRIC_DRAWS,
+    METRIC_UNKNOWN_OPCODES,
+    METRIC_CYCLE_NS,
+    METRIC_INPUT_NS,
+    METRIC_RENDER_NS,
+    METRIC_RUNAHEAD_NS,
+    METRIC_COUNTERS
+} MetricCounter;
+
+typedef enum
+{
+    METRIC_FRAME_TIME,
+    METRIC_SLEEP_OVERSHOOT,
+    METRIC_HISTOGRAMS
+} MetricHistogram;
+
+typedef enum
+{
+    METRICS_PROMETHEUS,
+    METRICS_JSON
+} MetricsFormat;
+
+typedef struct MetricsShard
+{
+    _Atomic uint64_t counters[METRIC_COUNTERS];
+    _Atomic uint64_t buckets[METRIC_HISTOGRAMS][HISTOGRAM_BUCKETS];
+    _Atomic uint64_t sums[METRIC_HISTOGRAMS];
+    struct MetricsShard *next;
+} MetricsShard;
+
+extern _Thread_local MetricsShard *metrics_shard;
+
+MetricsShard *register_metrics_shard(void);
+int start_metrics_export(const char *path, MetricsFormat format, int interval_ms);
+void stop_metrics_export(void);
+
+static inline void
+metric_add(_Atomic uint64_t *slot, uint64_t amount)
+{
+    uint64_t value = atomic_load_explicit(slot, memory_order_relaxed);
+
+    atomic_store_explicit(slot, value + amount, memory_order_relaxed);
+}
+
+static inline void
+count_metric(MetricCounter counter, uint64_t amount)
+{
+    MetricsShard *shard = metrics_shard ? metrics_shard : register_metrics_shard();
+
+    if(shard)
+        metric_add(&shard->counters[counter], amount);
+}
+
+static inline void
+observe_metric(MetricHistogram histogram, uint32_t value)
+{
+    MetricsShard *shard = metrics_shard ? metrics_shard : register_metrics_shard();
+
+    if(shard)
+    {
+        metric_add(&shard->buckets[histogram][histogram_bucket(value)], 1);
+        metric_add(&shard->sums[histogram], value);
+    }
+}
+
+#endif
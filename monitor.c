@@ -0,0 +1,509 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <SDL2/SDL.h>
+#include "monitor.h"
+#include "libchip8.h"
+#include "arena.h"
+#include "histogram.h"
+#include "metrics.h"
+
+/*
+    Each tile is the 64x32 display plus a one pixel gutter on the right
+    and bottom. All tiles live in one streaming texture that is drawn
+    with a single RenderCopy; only tiles whose published sequence moved
+    are redrawn, and each row of tiles uploads just the span between
+    its leftmost and rightmost changed tile.
+*/
+
+#define TILE_WIDTH 65
+#define TILE_HEIGHT 33
+#define WINDOW_WIDTH 1280
+#define MAX_SCALE 15
+
+#define PIXEL_ON 0xFFFFFFFF
+#define PIXEL_OFF 0x000000FF
+#define PIXEL_GUTTER 0x303030FF
+
+#define FRAME_NS (1000000000L / 60)
+#define MAX_CATCH_UP 4
+
+// workers hold each pseudo-random key for this many frames
+#define KEY_HOLD_FRAMES 8
+
+typedef struct
+{
+    Chip8Arena arena;
+    PublishedFrame *frames;
+    uint8_t rom[MAX_ROM_SIZE];
+    size_t rom_size;
+    atomic_int stop;
+} Monitor;
+
+typedef struct
+{
+    pthread_t thread;
+    Monitor *monitor;
+    int first;
+    int count;
+    uint64_t frames;
+} MonitorWorker;
+
+typedef struct
+{
+    SDL_Window *window;
+    SDL_Renderer *renderer;
+    SDL_Texture *texture;
+    uint32_t *pixels;
+    uint32_t *seen;
+    int columns;
+    int rows;
+    int width;
+    int height;
+} Atlas;
+
+void
+publish_frame(PublishedFrame *frame, const uint64_t *framebuffer)
+{
+    int changed = 0;
+
+    for(int y = 0; y < 32 && !changed; y++)
+        changed = atomic_load_explicit(&frame->rows[y], memory_order_relaxed) != framebuffer[y];
+
+    // an unchanged frame keeps its sequence, so the monitor skips the tile without copying it
+    if(!changed)
+        return;
+
+    uint32_t sequence = atomic_load_explicit(&frame->sequence, memory_order_relaxed);
+
+    atomic_store_explicit(&frame->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    for(int y = 0; y < 32; y++)
+        atomic_store_explicit(&frame->rows[y], framebuffer[y], memory_order_relaxed);
+
+    atomic_store_explicit(&frame->sequence, sequence + 2, memory_order_release);
+}
+
+/*
+    Copies the frame if it was republished since *seen. Returns 0 when
+    it has not changed, or when the worker is midway through writing
+    it; the caller tries again next time rather than waiting.
+*/
+
+int
+read_published_frame(PublishedFrame *frame, uint64_t *rows, uint32_t *seen)
+{
+    uint32_t sequence = atomic_load_explicit(&frame->sequence, memory_order_acquire);
+
+    if(sequence == *seen || (sequence & 1))
+        return 0;
+
+    for(int y = 0; y < 32; y++)
+        rows[y] = atomic_load_explicit(&frame->rows[y], memory_order_relaxed);
+
+    atomic_thread_fence(memory_order_acquire);
+
+    if(atomic_load_explicit(&frame->sequence, memory_order_relaxed) != sequence)
+        return 0;
+
+    *seen = sequence;
+
+    return 1;
+}
+
+static uint32_t
+next_random(uint32_t *state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    return *state = x;
+}
+
+static void *
+run_worker(void *arg)
+{
+    MonitorWorker *worker = arg;
+    Monitor *monitor = worker->monitor;
+    uint32_t *random = malloc(worker->count * sizeof(*random));
+    uint16_t *keys = calloc(worker->count, sizeof(*keys));
+    struct timespec deadline;
+
+    if(!random || !keys)
+    {
+        perror("could not start monitor worker");
+        free(random);
+        free(keys);
+        return NULL;
+    }
+
+    place_instances(&monitor->arena, worker->first, worker->count, monitor->rom, monitor->rom_size);
+
+    for(int n = 0; n < worker->count; n++)
+    {
+        seed_random(arena_instance(&monitor->arena, worker->first + n), worker->first + n + 1);
+        random[n] = 0x9E3779B9u * (worker->first + n + 1);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+    while(!atomic_load_explicit(&monitor->stop, memory_order_relaxed))
+    {
+        for(int n = 0; n < worker->count; n++)
+        {
+            Chip8 *chip = arena_instance(&monitor->arena, worker->first + n);
+
+            if(worker->frames % KEY_HOLD_FRAMES == 0)
+            {
+                uint32_t r = next_random(&random[n]);
+                keys[n] = (r & 3) ? 1 << ((r >> 2) & 15) : 0;
+            }
+
+            chip8_step_frames(chip, 1, keys[n]);
+            publish_frame(&monitor->frames[worker->first + n], chip->framebuffer);
+        }
+
+        worker->frames++;
+        count_metric(METRIC_FRAMES_EMULATED, worker->count);
+        count_metric(METRIC_INSTRUCTIONS, (uint64_t)worker->count * INSTRUCTIONS_PER_FRAME);
+
+        deadline.tv_nsec += FRAME_NS;
+
+        if(deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        // too far behind to catch up; carry on from now rather than bursting
+        if((now.tv_sec - deadline.tv_sec) * 1000000000L + (now.tv_nsec - deadline.tv_nsec) > MAX_CATCH_UP * FRAME_NS)
+            deadline = now;
+        else
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+    }
+
+    free(random);
+    free(keys);
+
+    return NULL;
+}
+
+static void
+draw_tile(Atlas *atlas, int column, int row, const uint64_t *rows)
+{
+    uint32_t *tile = atlas->pixels + row * TILE_HEIGHT * atlas->width + column * TILE_WIDTH;
+
+    for(int y = 0; y < 32; y++)
+    {
+        uint32_t *out = tile + y * atlas->width;
+
+        for(int x = 0; x < 64; x++)
+            out[x] = (rows[y] >> (63 - x)) & 1 ? PIXEL_ON : PIXEL_OFF;
+    }
+}
+
+static int
+init_atlas(Atlas *atlas, int instances)
+{
+    atlas->columns = 1;
+
+    while(atlas->columns * atlas->columns < instances)
+        atlas->columns++;
+
+    atlas->rows = (instances + atlas->columns - 1) / atlas->columns;
+    atlas->width = atlas->columns * TILE_WIDTH;
+    atlas->height = atlas->rows * TILE_HEIGHT;
+    atlas->pixels = malloc((size_t)atlas->width * atlas->height * sizeof(uint32_t));
+    atlas->seen = calloc(instances, sizeof(uint32_t));
+    atlas->window = NULL;
+    atlas->renderer = NULL;
+    atlas->texture = NULL;
+
+    if(!atlas->pixels || !atlas->seen)
+    {
+        perror("could not allocate monitor atlas");
+        return -1;
+    }
+
+    for(int i = 0; i < atlas->width * atlas->height; i++)
+        atlas->pixels[i] = PIXEL_GUTTER;
+
+    for(int n = 0; n < instances; n++)
+    {
+        uint64_t blank[32] = { 0 };
+        draw_tile(atlas, n % atlas->columns, n / atlas->columns, blank);
+    }
+
+    int scale = WINDOW_WIDTH / atlas->width;
+
+    if(scale < 1)
+        scale = 1;
+    if(scale > MAX_SCALE)
+        scale = MAX_SCALE;
+
+    atlas->window = SDL_CreateWindow("Chip-8 Monitor", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+                                     atlas->width * scale, atlas->height * scale, SDL_WINDOW_SHOWN);
+
+    if(!atlas->window)
+    {
+        perror("Window could not be created");
+        return -1;
+    }
+
+    atlas->renderer = SDL_CreateRenderer(atlas->window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+
+    if(!atlas->renderer)
+    {
+        perror("Renderer could not be created");
+        return -1;
+    }
+
+    atlas->texture = SDL_CreateTexture(atlas->renderer, SDL_PIXELFORMAT_RGBA8888,
+                                       SDL_TEXTUREACCESS_STREAMING, atlas->width, atlas->height);
+
+    if(!atlas->texture)
+    {
+        perror("Texture could not be created");
+        return -1;
+    }
+
+    SDL_UpdateTexture(atlas->texture, NULL, atlas->pixels, atlas->width * sizeof(uint32_t));
+
+    return 0;
+}
+
+static void
+close_atlas(Atlas *atlas)
+{
+    if(atlas->texture)
+        SDL_DestroyTexture(atlas->texture);
+    if(atlas->renderer)
+        SDL_DestroyRenderer(atlas->renderer);
+    if(atlas->window)
+        SDL_DestroyWindow(atlas->window);
+
+    free(atlas->pixels);
+    free(atlas->seen);
+    SDL_Quit();
+}
+
+// returns the number of tiles that changed
+static int
+refresh_atlas(Atlas *atlas, PublishedFrame *frames, int instances)
+{
+    int changed = 0;
+
+    for(int row = 0; row < atlas->rows; row++)
+    {
+        int left = atlas->columns;
+        int right = -1;
+
+        for(int column = 0; column < atlas->columns; column++)
+        {
+            int n = row * atlas->columns + column;
+            uint64_t rows[32];
+
+            if(n >= instances)
+                break;
+
+            if(!read_published_frame(&frames[n], rows, &atlas->seen[n]))
+                continue;
+
+            draw_tile(atlas, column, row, rows);
+            changed++;
+
+            if(column < left)
+                left = column;
+            right = column;
+        }
+
+        if(right < left)
+            continue;
+
+        SDL_Rect span = { left * TILE_WIDTH, row * TILE_HEIGHT, (right - left + 1) * TILE_WIDTH, TILE_HEIGHT };
+
+        SDL_UpdateTexture(atlas->texture, &span, atlas->pixels + span.y * atlas->width + span.x,
+                          atlas->width * sizeof(uint32_t));
+    }
+
+    return changed;
+}
+
+static int
+poll_quit(void)
+{
+    SDL_Event e;
+    int quit = 0;
+
+    while(SDL_PollEvent(&e))
+    {
+        if(e.type == SDL_QUIT)
+            quit = 1;
+        else if(e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_ESCAPE)
+            quit = 1;
+    }
+
+    return quit;
+}
+
+static int
+load_monitor_rom(Monitor *monitor, const char *path)
+{
+    FILE *input = fopen(path, "rb");
+
+    if(!input)
+    {
+        perror("could not open rom");
+        return -1;
+    }
+
+    monitor->rom_size = fread(monitor->rom, 1, sizeof(monitor->rom), input);
+    fclose(input);
+
+    return 0;
+}
+
+int
+run_monitor(MonitorOptions *options)
+{
+    static Monitor monitor;
+    Atlas atlas;
+    int instances = options->instances;
+    int threads = options->threads;
+
+    if(threads <= 0)
+    {
+        // leave one core for the display thread
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    }
+    if(threads < 1)
+        threads = 1;
+    if(threads > instances)
+        threads = instances;
+
+    if(load_monitor_rom(&monitor, options->rom))
+        return -1;
+
+    if(init_arena(&monitor.arena, instances))
+        return -1;
+
+    monitor.frames = aligned_alloc(64, instances * sizeof(PublishedFrame));
+
+    if(!monitor.frames)
+    {
+        perror("could not allocate published frames");
+        free_arena(&monitor.arena);
+        return -1;
+    }
+
+    memset(monitor.frames, 0, instances * sizeof(PublishedFrame));
+    atomic_init(&monitor.stop, 0);
+
+    if(init_atlas(&atlas, instances))
+    {
+        close_atlas(&atlas);
+        free(monitor.frames);
+        free_arena(&monitor.arena);
+        return -1;
+    }
+
+    MonitorWorker *workers = calloc(threads, sizeof(MonitorWorker));
+    int started = 0;
+
+    for(int t = 0; workers && t < threads; t++)
+    {
+        workers[t].monitor = &monitor;
+        workers[t].first = instances * t / threads;
+        workers[t].count = instances * (t + 1) / threads - workers[t].first;
+
+        if(pthread_create(&workers[t].thread, NULL, run_worker, &workers[t]))
+        {
+            perror("could not start monitor worker");
+            break;
+        }
+
+        started++;
+    }
+
+    Histogram present_interval, refresh_time;
+    uint64_t frequency = SDL_GetPerformanceFrequency();
+    uint64_t period = frequency / 60;
+    uint64_t last_present = 0;
+    uint64_t changed_tiles = 0;
+    long presents = 0;
+
+    init_histogram(&present_interval);
+    init_histogram(&refresh_time);
+
+    while(started && !poll_quit() && (!options->frames || presents < options->frames))
+    {
+        uint64_t start = SDL_GetPerformanceCounter();
+
+        changed_tiles += refresh_atlas(&atlas, monitor.frames, instances);
+        SDL_RenderCopy(atlas.renderer, atlas.texture, NULL, NULL);
+
+        uint64_t rendered = SDL_GetPerformanceCounter();
+        record_histogram(&refresh_time, (uint32_t)((rendered - start) * 1000000 / frequency));
+        count_metric(METRIC_RENDER_NS, (rendered - start) * 1000000000 / frequency);
+
+        SDL_RenderPresent(atlas.renderer);
+        count_metric(METRIC_FRAMES_PRESENTED, 1);
+        presents++;
+
+        uint64_t now = SDL_GetPerformanceCounter();
+
+        // without vsync the present returns at once; fall back to the timer
+        if(last_present && now - last_present < period / 2)
+        {
+            SDL_Delay((uint32_t)((last_present + period - now) * 1000 / frequency));
+            now = SDL_GetPerformanceCounter();
+        }
+
+        if(last_present)
+            record_histogram(&present_interval, (uint32_t)((now - last_present) * 1000000 / frequency));
+
+        last_present = now;
+    }
+
+    atomic_store(&monitor.stop, 1);
+
+    uint64_t worker_frames = 0;
+
+    for(int t = 0; t < started; t++)
+    {
+        pthread_join(workers[t].thread, NULL);
+        worker_frames += workers[t].frames * workers[t].count;
+    }
+
+    if(presents)
+    {
+        double seconds = present_interval.count ? present_interval.sum / 1e6 : 0;
+
+        fprintf(stderr, "monitor: %d instances on %d threads, %dx%d tiles, %.1f changed per present\n",
+                instances, started, atlas.columns, atlas.rows, (double)changed_tiles / presents);
+        if(seconds > 0)
+            fprintf(stderr, "monitor: %.2f presents/s, %.0f instance frames/s\n",
+                    present_interval.count / seconds, worker_frames / seconds);
+        print_histogram(&refresh_time, "atlas refresh", stderr);
+        print_histogram(&present_interval, "present interval", stderr);
+    }
+
+    close_atlas(&atlas);
+    free(workers);
+    free(monitor.frames);
+    free_arena(&monitor.arena);
+
+    return started ? 0 : -1;
+}
@@ -0,0 +1,34 @@
+#ifndef MONITOR_H
+#define MONITOR_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+    Monitor mode: many instances on worker threads, shown as tiles of
+    one window. Workers never share a Chip8 with the display thread;
+    after each frame they publish the framebuffer through a per-tile
+    seqlock, and the display thread copies whatever was last complete.
+    A torn read is simply retried on the next display frame, so neither
+    side ever waits for the other.
+*/
+
+typedef struct
+{
+    _Alignas(64) _Atomic uint32_t sequence;
+    _Atomic uint64_t rows[32];
+} PublishedFrame;
+
+typedef struct
+{
+    char *rom;
+    int instances;
+    int threads;
+    long frames;
+} MonitorOptions;
+
+void publish_frame(PublishedFrame *frame, const uint64_t *framebuffer);
+int read_published_frame(PublishedFrame *frame, uint64_t *rows, uint32_t *seen);
+int run_monitor(MonitorOptions *options);
+
+#endif
@@ -0,0 +1,444 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "netplay.h"
+#include "protocol.h"
+
+/*
+    Frame f's snapshot is the machine before frame f ran, so a rollback
+    to f restores it and replays f..frame-1. Snapshots, inputs and the
+    remote input each frame was actually run with all live in rings of
+    NETPLAY_RING frames; the prediction limit keeps everything a
+    rollback can reach inside them.
+*/
+
+#define PACKET_MAGIC 0x504E3843u  // "C8NP"
+#define PACKET_HEADER 23
+#define RESEND_MS 4
+#define LINGER_MS 250
+#define NO_ROLLBACK UINT32_MAX
+
+static uint64_t
+now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t
+next_random(Netplay *netplay)
+{
+    netplay->rng ^= netplay->rng << 13;
+    netplay->rng ^= netplay->rng >> 7;
+    netplay->rng ^= netplay->rng << 17;
+
+    return (uint32_t)(netplay->rng >> 32);
+}
+
+static int
+resolve_peer(struct sockaddr_in *addr, const char *peer)
+{
+    char host[256];
+    const char *colon = strrchr(peer, ':');
+    struct addrinfo hints = { 0 };
+    struct addrinfo *result;
+
+    if(!colon || colon == peer || (size_t)(colon - peer) >= sizeof(host))
+    {
+        fprintf(stderr, "netplay peer must be HOST:PORT: %s\n", peer);
+        return -1;
+    }
+
+    memcpy(host, peer, colon - peer);
+    host[colon - peer] = '\0';
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    int status = getaddrinfo(host, colon + 1, &hints, &result);
+
+    if(status)
+    {
+        fprintf(stderr, "could not resolve %s: %s\n", peer, gai_strerror(status));
+        return -1;
+    }
+
+    memcpy(addr, result->ai_addr, sizeof(*addr));
+    freeaddrinfo(result);
+
+    return 0;
+}
+
+int
+open_netplay(Netplay *netplay, const NetplayOptions *options, Chip8 *chip)
+{
+    struct sockaddr_in local = { 0 };
+
+    memset(netplay, 0, sizeof(*netplay));
+    netplay->local_mask = options->keys;
+    netplay->max_prediction = options->max_prediction > 0 ? options->max_prediction : NETPLAY_DEFAULT_PREDICTION;
+    netplay->rollback_from = NO_ROLLBACK;
+    netplay->delay_ms = options->delay_ms;
+    netplay->jitter_ms = options->jitter_ms;
+    netplay->loss_percent = options->loss_percent;
+    netplay->rng = 0x9E3779B97F4A7C15ull ^ ((uint64_t)options->local_port << 32 | options->seed);
+    init_histogram(&netplay->rollback_time);
+
+    // the peer can be this many frames ahead too, and every one must stay in the rings
+    if(netplay->max_prediction > NETPLAY_RING / 2 - 1)
+        netplay->max_prediction = NETPLAY_RING / 2 - 1;
+
+    if(resolve_peer(&netplay->peer, options->peer))
+        return -1;
+
+    netplay->fd = socket(AF_INET, SOCK_DGRAM, 0);
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons(options->local_port);
+
+    if(netplay->fd < 0 || bind(netplay->fd, (struct sockaddr *)&local, sizeof(local)) < 0 ||
+       fcntl(netplay->fd, F_SETFL, O_NONBLOCK) < 0)
+    {
+        perror("could not open netplay socket");
+        if(netplay->fd >= 0)
+            close(netplay->fd);
+        return -1;
+    }
+
+    // both peers must start from the same machine
+    seed_random(chip, options->seed);
+    memset(chip->keypad, 0, sizeof(chip->keypad));
+
+    return 0;
+}
+
+static void
+transmit(Netplay *netplay, const uint8_t *data, int size)
+{
+    if(sendto(netplay->fd, data, size, 0, (struct sockaddr *)&netplay->peer, sizeof(netplay->peer)) < 0 &&
+       errno != EAGAIN && errno != ECONNREFUSED)
+        perror("netplay send failed");
+}
+
+/*
+    The latency and loss simulator sits in front of the socket: a
+    packet is dropped with loss_percent probability, otherwise held
+    for delay_ms plus up to jitter_ms, so packets can also arrive out
+    of order.
+*/
+
+static void
+send_packet(Netplay *netplay, const uint8_t *data, int size)
+{
+    netplay->packets_sent++;
+
+    if(netplay->loss_percent && (int)(next_random(netplay) % 100) < netplay->loss_percent)
+    {
+        netplay->packets_dropped++;
+        return;
+    }
+
+    if(!netplay->delay_ms && !netplay->jitter_ms)
+    {
+        transmit(netplay, data, size);
+        return;
+    }
+
+    if(netplay->queued == NETPLAY_DELAY_QUEUE)
+    {
+        netplay->packets_dropped++;
+        return;
+    }
+
+    DelayedPacket *packet = &netplay->queue[netplay->queued++];
+
+    packet->due = now_ms() + netplay->delay_ms + next_random(netplay) % (netplay->jitter_ms + 1);
+    packet->size = size;
+    memcpy(packet->data, data, size);
+}
+
+static void
+flush_delayed(Netplay *netplay)
+{
+    uint64_t now = now_ms();
+
+    for(int n = 0; n < netplay->queued;)
+    {
+        if(netplay->queue[n].due <= now)
+        {
+            transmit(netplay, netplay->queue[n].data, netplay->queue[n].size);
+            netplay->queue[n] = netplay->queue[--netplay->queued];
+        }
+        else
+            n++;
+    }
+}
+
+// sends every local input the peer has not acknowledged yet
+static void
+send_inputs(Netplay *netplay)
+{
+    uint8_t packet[NETPLAY_MAX_PACKET];
+    uint32_t first = netplay->peer_ack;
+    uint32_t count = netplay->frame - first;
+
+    if(count > NETPLAY_MAX_INPUTS)
+        count = NETPLAY_MAX_INPUTS;
+
+    put32(packet, PACKET_MAGIC);
+    put16(packet + 4, netplay->local_mask);
+    put32(packet + 6, first);
+    put32(packet + 10, netplay->remote_frames);
+    put32(packet + 14, (uint32_t)now_ms());
+    put32(packet + 18, netplay->peer_time);
+    packet[22] = count;
+
+    for(uint32_t n = 0; n < count; n++)
+        put16(packet + PACKET_HEADER + 2 * n, netplay->local[(first + n) % NETPLAY_RING]);
+
+    send_packet(netplay, packet, PACKET_HEADER + 2 * count);
+    netplay->last_send = now_ms();
+}
+
+/*
+    Takes in any remote inputs that extend the confirmed run. When one
+    differs from what a frame already run assumed, the earliest such
+    frame becomes the rollback point.
+*/
+
+static void
+receive_packets(Netplay *netplay)
+{
+    uint8_t packet[NETPLAY_MAX_PACKET];
+    ssize_t size;
+
+    while((size = recv(netplay->fd, packet, sizeof(packet), 0)) > 0)
+    {
+        if(size < PACKET_HEADER || get32(packet) != PACKET_MAGIC || size < PACKET_HEADER + 2 * packet[22])
+            continue;
+
+        uint16_t mask = get16(packet + 4);
+        uint32_t first = get32(packet + 6);
+        uint32_t ack = get32(packet + 10);
+        uint32_t echo = get32(packet + 18);
+        uint32_t count = packet[22];
+
+        netplay->packets_received++;
+
+        // each peer would apply its own input for a shared key and the machines would drift apart
+        if(mask & netplay->local_mask)
+        {
+            if(!netplay->conflict)
+                fprintf(stderr, "netplay: both peers own keys %04X; split them with --net-keys\n",
+                        mask & netplay->local_mask);
+            netplay->conflict = 1;
+            return;
+        }
+
+        if(ack > netplay->peer_ack && ack <= netplay->frame)
+            netplay->peer_ack = ack;
+
+        if(echo)
+        {
+            double rtt = (double)((uint32_t)now_ms() - echo);
+
+            netplay->rtt_ms = netplay->rtt_ms ? netplay->rtt_ms * 0.875 + rtt * 0.125 : rtt;
+        }
+
+        netplay->peer_time = get32(packet + 14);
+
+        if(first > netplay->remote_frames)
+            continue;
+
+        for(uint32_t g = netplay->remote_frames; g < first + count; g++)
+        {
+            uint16_t keys = get16(packet + PACKET_HEADER + 2 * (g - first));
+
+            if(g >= netplay->frame + NETPLAY_RING / 2)
+                break;
+
+            netplay->remote[g % NETPLAY_RING] = keys;
+            netplay->last_remote = keys;
+            netplay->remote_frames = g + 1;
+
+            if(g < netplay->frame && keys != netplay->used[g % NETPLAY_RING] && g < netplay->rollback_from)
+                netplay->rollback_from = g;
+        }
+    }
+}
+
+static void
+simulate(Netplay *netplay, Chip8 *chip, uint32_t f)
+{
+    uint16_t remote = f < netplay->remote_frames ? netplay->remote[f % NETPLAY_RING] : netplay->last_remote;
+    uint16_t keys = (netplay->local[f % NETPLAY_RING] & netplay->local_mask) | (remote & ~netplay->local_mask);
+
+    netplay->snapshots[f % NETPLAY_RING] = *chip;
+    netplay->used[f % NETPLAY_RING] = remote;
+
+    for(int k = 0; k < 16; k++)
+        chip->keypad[k] = (keys >> k) & 1;
+
+    step_frame(chip);
+}
+
+static void
+roll_back(Netplay *netplay, Chip8 *chip)
+{
+    uint32_t from = netplay->rollback_from;
+    uint64_t start = now_ns();
+
+    netplay->rollback_from = NO_ROLLBACK;
+
+    if(from >= netplay->frame)
+        return;
+
+    *chip = netplay->snapshots[from % NETPLAY_RING];
+
+    for(uint32_t f = from; f < netplay->frame; f++)
+        simulate(netplay, chip, f);
+
+    uint32_t depth = netplay->frame - from;
+
+    netplay->rollbacks++;
+    netplay->resimulated += depth;
+    if(depth > netplay->max_depth)
+        netplay->max_depth = depth;
+
+    record_histogram(&netplay->rollback_time, (uint32_t)((now_ns() - start) / 1000));
+}
+
+// sleeps until a packet arrives or the simulator has one to let go, at most 1 ms
+static void
+wait_for_peer(Netplay *netplay)
+{
+    struct pollfd pfd = { netplay->fd, POLLIN, 0 };
+
+    poll(&pfd, 1, 1);
+    flush_delayed(netplay);
+    receive_packets(netplay);
+
+    if(now_ms() - netplay->last_send >= RESEND_MS)
+        send_inputs(netplay);
+}
+
+/*
+    Runs one frame with the local keys. Returns 0, or -1 once the peer
+    has been silent for so long that the session is over or turns out
+    to own some of the same keys.
+*/
+
+int
+netplay_frame(Netplay *netplay, Chip8 *chip, uint16_t keys)
+{
+    uint64_t stalled = 0;
+
+    flush_delayed(netplay);
+    receive_packets(netplay);
+
+    while((int32_t)(netplay->frame - netplay->remote_frames) >= netplay->max_prediction && !netplay->conflict)
+    {
+        if(!stalled)
+        {
+            stalled = now_ms();
+            netplay->stalls++;
+        }
+        else if(now_ms() - stalled > 10000)
+        {
+            fprintf(stderr, "netplay: no input from the peer for 10 s\n");
+            return -1;
+        }
+
+        wait_for_peer(netplay);
+    }
+
+    if(netplay->conflict)
+        return -1;
+
+    if(netplay->rollback_from != NO_ROLLBACK)
+        roll_back(netplay, chip);
+
+    netplay->local[netplay->frame % NETPLAY_RING] = keys & netplay->local_mask;
+    simulate(netplay, chip, netplay->frame);
+    netplay->frame++;
+
+    send_inputs(netplay);
+    flush_delayed(netplay);
+
+    return 0;
+}
+
+/*
+    Stops advancing and waits until every remote input up to the
+    current frame is in and the peer has all of ours, so both sides
+    end on the same confirmed state. Lingers briefly afterwards so the
+    peer gets our final acknowledgement. Returns -1 on timeout.
+*/
+
+int
+finish_netplay(Netplay *netplay, Chip8 *chip, int timeout_ms)
+{
+    uint64_t start = now_ms();
+    uint64_t done = 0;
+
+    send_inputs(netplay);
+
+    for(;;)
+    {
+        wait_for_peer(netplay);
+
+        if(netplay->rollback_from != NO_ROLLBACK)
+            roll_back(netplay, chip);
+
+        if(!done && netplay->remote_frames >= netplay->frame && netplay->peer_ack >= netplay->frame)
+            done = now_ms();
+
+        if(done && now_ms() - done >= LINGER_MS + (uint64_t)netplay->delay_ms + netplay->jitter_ms)
+            break;
+
+        if(netplay->conflict || (!done && now_ms() - start > (uint64_t)timeout_ms))
+            break;
+    }
+
+    return netplay->remote_frames >= netplay->frame ? 0 : -1;
+}
+
+void
+print_netplay_stats(const Netplay *netplay)
+{
+    fprintf(stderr, "netplay: %u frames, %llu rollbacks re-running %llu frames (deepest %u), %llu stalls\n",
+            netplay->frame, (unsigned long long)netplay->rollbacks, (unsigned long long)netplay->resimulated,
+            netplay->max_depth, (unsigned long long)netplay->stalls);
+    fprintf(stderr, "netplay: %llu packets sent, %llu dropped by the simulator, %llu received, rtt %.1f ms\n",
+            (unsigned long long)netplay->packets_sent, (unsigned long long)netplay->packets_dropped,
+            (unsigned long long)netplay->packets_received, netplay->rtt_ms);
+    print_histogram(&netplay->rollback_time, "rollback time", stderr);
+}
+
+void
+close_netplay(Netplay *netplay)
+{
+    close(netplay->fd);
+    netplay->fd = -1;
+}
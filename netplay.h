@@ -0,0 +1,103 @@
+#ifndef NETPLAY_H
+#define NETPLAY_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+#include "chip8.h"
+#include "histogram.h"
+
+/*
+    Rollback netplay for two peers sharing one keypad over UDP. Each
+    peer owns a mask of the 16 keys; the keys the machine sees on a
+    frame are the owner's keys from each side. The masks must not
+    overlap, and a session whose peers both claim a key is ended. Both peers run the same
+    machine from the same seed and advance it in whole frames
+    (step_frame), sending their own input for every frame. A frame
+    whose remote input has not arrived yet runs on a prediction, the
+    last remote input seen; when the real input turns out different,
+    the machine is restored from the snapshot taken at the start of
+    that frame and run forward again. A peer never runs more than
+    max_prediction frames past the last confirmed remote input and
+    waits for its peer instead.
+
+    packet := u32 magic | u16 owned keys | u32 first frame | u32 ack |
+              u32 time ms | u32 echoed time ms | u8 count | u16 keys[count]
+
+    All integers are little-endian. keys[] holds the sender's input for
+    frames first..first+count-1: every input the peer has not yet
+    acknowledged, so a lost packet is covered by the next one. ack is
+    the number of frames of the peer's input received so far.
+*/
+
+#define NETPLAY_RING 64
+#define NETPLAY_MAX_INPUTS 64
+#define NETPLAY_DEFAULT_PREDICTION 8
+#define NETPLAY_DELAY_QUEUE 256
+#define NETPLAY_MAX_PACKET (23 + 2 * NETPLAY_MAX_INPUTS)
+
+typedef struct
+{
+    int local_port;
+    char *peer;
+    uint16_t keys;
+    int max_prediction;
+    uint32_t seed;
+    int delay_ms;
+    int jitter_ms;
+    int loss_percent;
+} NetplayOptions;
+
+// a packet held back by the latency and loss simulator
+typedef struct
+{
+    uint64_t due;
+    int size;
+    uint8_t data[NETPLAY_MAX_PACKET];
+} DelayedPacket;
+
+typedef struct
+{
+    int fd;
+    struct sockaddr_in peer;
+    uint16_t local_mask;
+    int conflict;
+    int max_prediction;
+
+    uint32_t frame;
+    uint32_t remote_frames;
+    uint32_t peer_ack;
+    uint32_t rollback_from;
+    uint16_t local[NETPLAY_RING];
+    uint16_t remote[NETPLAY_RING];
+    uint16_t used[NETPLAY_RING];
+    uint16_t last_remote;
+    Chip8 snapshots[NETPLAY_RING];
+
+    uint32_t peer_time;
+    uint64_t last_send;
+    double rtt_ms;
+
+    int delay_ms;
+    int jitter_ms;
+    int loss_percent;
+    uint64_t rng;
+    DelayedPacket queue[NETPLAY_DELAY_QUEUE];
+    int queued;
+
+    uint64_t packets_sent;
+    uint64_t packets_received;
+    uint64_t packets_dropped;
+    uint64_t rollbacks;
+    uint64_t resimulated;
+    uint32_t max_depth;
+    uint64_t stalls;
+    Histogram rollback_time;
+} Netplay;
+
+int open_netplay(Netplay *netplay, const NetplayOptions *options, Chip8 *chip);
+int netplay_frame(Netplay *netplay, Chip8 *chip, uint16_t keys);
+int finish_netplay(Netplay *netplay, Chip8 *chip, int timeout_ms);
+void print_netplay_stats(const Netplay *netplay);
+void close_netplay(Netplay *netplay);
+
+#endif
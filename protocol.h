@@ -0,0 +1,85 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+
+/*
+    chip8d wire format, all integers little-endian.
+
+    message := u32 size | u16 count | command[count]     (size counts bytes after itself)
+    command := u8 op | u8 0 | u16 session | u32 arg | payload
+    reply   := u32 size | u16 count | result[count]
+    result  := u8 status | u8 0 | u16 session | u32 len | payload[len]
+
+    Only OP_LOAD carries a command payload, arg bytes of ROM. Commands
+    run in order, so one message can create, load and step many sessions
+    in a single round trip. STEP, FRAMES and KEYS also accept
+    ALL_SESSIONS as the session id. Every command runs on the server's
+    one thread, so STEP and FRAMES counts above MAX_STEP and MAX_FRAMES
+    are rejected with STATUS_BAD_REQUEST; send several commands instead.
+*/
+
+#define DEFAULT_SOCKET_PATH "/tmp/chip8d.sock"
+#define MAX_MESSAGE_SIZE (1 << 24)
+#define MAX_SESSIONS 4096
+#define ALL_SESSIONS 0xFFFF
+#define MAX_STEP 6000
+#define MAX_FRAMES 600
+
+#define MESSAGE_HEADER_SIZE 6
+#define COMMAND_HEADER_SIZE 8
+#define RESULT_HEADER_SIZE 8
+
+#define DISPLAY_PAYLOAD_SIZE (32 * 64 / 8)
+#define REGS_PAYLOAD_SIZE 68
+
+enum
+{
+    OP_CREATE = 1,  // -> session id in the result header
+    OP_DESTROY,
+    OP_LOAD,        // arg = ROM size, payload = ROM
+    OP_KEYS,        // arg = keypad bitmask, bit n = key n
+    OP_STEP,        // arg = instructions
+    OP_FRAMES,      // arg = frames
+    OP_DISPLAY,     // -> 256 bytes, one bit per pixel, MSB leftmost
+    OP_REGS,        // -> v[16] i pc sp dt st 0 cycles(u64) stack[16] unknown opcodes(u32)
+    OP_SAVE,        // snapshot into the session's slot
+    OP_RESTORE      // restore the session's slot
+};
+
+enum
+{
+    STATUS_OK = 0,
+    STATUS_BAD_SESSION,
+    STATUS_BAD_REQUEST,
+    STATUS_NO_SNAPSHOT,
+    STATUS_FULL
+};
+
+static inline void
+put16(uint8_t *p, uint16_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+}
+
+static inline void
+put32(uint8_t *p, uint32_t value)
+{
+    put16(p, value);
+    put16(p + 2, value >> 16);
+}
+
+static inline uint16_t
+get16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t
+get32(const uint8_t *p)
+{
+    return get16(p) | ((uint32_t)get16(p + 2) << 16);
+}
+
+#endif
@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ramsearch.h"
+
+/*
+    Filters run with GCC vector extensions over 16 bytes at a time,
+    which map to plain SSE2 or NEON compares without extra target
+    flags. Snapshots are walked in the order they were taken, folding
+    each step into "rose" and "fell" masks that stay in L1, so a filter
+    over thousands of snapshots is a single linear read of them.
+*/
+
+typedef uint8_t ByteVector __attribute__((vector_size(16)));
+
+#define VECTOR_SIZE ((int)sizeof(ByteVector))
+#define SNAPSHOT_ALIGN 64
+
+static inline ByteVector
+load_vector(const uint8_t *bytes)
+{
+    return *(const ByteVector *)bytes;
+}
+
+static inline void
+store_vector(uint8_t *bytes, ByteVector vector)
+{
+    *(ByteVector *)bytes = vector;
+}
+
+static int
+count_candidates(const RamSearch *search)
+{
+    int count = 0;
+
+    for(int addr = 0; addr < RAM_SIZE; addr++)
+        count += search->candidates[addr] & 1;
+
+    return count;
+}
+
+void
+init_ram_search(RamSearch *search)
+{
+    search->snapshots = NULL;
+    search->count = 0;
+    search->capacity = 0;
+    search->mark = 0;
+    reset_candidates(search);
+}
+
+void
+close_ram_search(RamSearch *search)
+{
+    free(search->snapshots);
+    search->snapshots = NULL;
+    search->count = search->capacity = 0;
+}
+
+// snapshots live in one aligned block, doubled as needed, so vector loads need no fixups
+int
+record_snapshot(RamSearch *search, const Chip8 *chip)
+{
+    if(search->count == search->capacity)
+    {
+        int capacity = search->capacity ? search->capacity * 2 : 256;
+        uint8_t (*snapshots)[RAM_SIZE] = aligned_alloc(SNAPSHOT_ALIGN, (size_t)capacity * RAM_SIZE);
+
+        if(!snapshots)
+        {
+            perror("could not record snapshot");
+            return -1;
+        }
+
+        if(search->count)
+            memcpy(snapshots, search->snapshots, (size_t)search->count * RAM_SIZE);
+
+        free(search->snapshots);
+        search->snapshots = snapshots;
+        search->capacity = capacity;
+    }
+
+    memcpy(search->snapshots[search->count++], chip->memory, RAM_SIZE);
+
+    return 0;
+}
+
+void
+clear_snapshots(RamSearch *search)
+{
+    search->count = 0;
+    search->mark = 0;
+}
+
+void
+reset_candidates(RamSearch *search)
+{
+    memset(search->candidates, 0xFF, RAM_SIZE);
+    search->remaining = RAM_SIZE;
+}
+
+/*
+    Narrows the candidates by the snapshots from..to inclusive; a
+    negative from starts where the previous filter ended, a negative
+    to means the latest snapshot. SEARCH_VALUE compares only snapshot
+    `to` against value. Returns the number of candidates left, or -1
+    if the range holds too few snapshots.
+*/
+
+int
+filter_candidates(RamSearch *search, SearchFilter filter, int from, int to, uint8_t value)
+{
+    _Alignas(64) uint8_t rose[RAM_SIZE];
+    _Alignas(64) uint8_t fell[RAM_SIZE];
+
+    if(to < 0)
+        to = search->count - 1;
+    if(from < 0)
+        from = (filter == SEARCH_VALUE) ? to : search->mark;
+
+    if(to >= search->count || from < 0 || from > to || (filter != SEARCH_VALUE && from == to))
+        return -1;
+
+    if(filter == SEARCH_VALUE)
+    {
+        ByteVector wanted = (ByteVector){ 0 } + value;
+
+        for(int addr = 0; addr < RAM_SIZE; addr += VECTOR_SIZE)
+        {
+            ByteVector match = (ByteVector)(load_vector(&search->snapshots[to][addr]) == wanted);
+
+            store_vector(&search->candidates[addr], load_vector(&search->candidates[addr]) & match);
+        }
+    }
+    else
+    {
+        memset(rose, 0, RAM_SIZE);
+        memset(fell, 0, RAM_SIZE);
+
+        for(int s = from + 1; s <= to; s++)
+        {
+            const uint8_t *before = search->snapshots[s - 1];
+            const uint8_t *after = search->snapshots[s];
+
+            for(int addr = 0; addr < RAM_SIZE; addr += VECTOR_SIZE)
+            {
+                ByteVector earlier = load_vector(&before[addr]);
+                ByteVector later = load_vector(&after[addr]);
+
+                store_vector(&rose[addr], load_vector(&rose[addr]) | (ByteVector)(later > earlier));
+                store_vector(&fell[addr], load_vector(&fell[addr]) | (ByteVector)(later < earlier));
+            }
+        }
+
+        for(int addr = 0; addr < RAM_SIZE; addr += VECTOR_SIZE)
+        {
+            ByteVector up = load_vector(&rose[addr]);
+            ByteVector down = load_vector(&fell[addr]);
+            ByteVector keep;
+
+            if(filter == SEARCH_EQUAL)
+                keep = ~(up | down);
+            else if(filter == SEARCH_CHANGED)
+                keep = up | down;
+            else if(filter == SEARCH_INCREASED)
+                keep = up & ~down;
+            else
+                keep = down & ~up;
+
+            store_vector(&search->candidates[addr], load_vector(&search->candidates[addr]) & keep);
+        }
+    }
+
+    search->mark = to;
+    search->remaining = count_candidates(search);
+
+    return search->remaining;
+}
+
+// the first candidate at or after addr, or -1
+int
+next_candidate(const RamSearch *search, int addr)
+{
+    for(; addr < RAM_SIZE; addr++)
+        if(search->candidates[addr])
+            return addr;
+
+    return -1;
+}
+
+int
+pin_address(PinSet *pins, uint16_t addr, uint8_t value)
+{
+    addr &= RAM_SIZE - 1;
+
+    for(int n = 0; n < pins->count; n++)
+    {
+        if(pins->addr[n] == addr)
+        {
+            pins->value[n] = value;
+            return 0;
+        }
+    }
+
+    if(pins->count == RAM_PINS)
+        return -1;
+
+    pins->addr[pins->count] = addr;
+    pins->value[pins->count++] = value;
+
+    return 0;
+}
+
+void
+unpin_address(PinSet *pins, uint16_t addr)
+{
+    addr &= RAM_SIZE - 1;
+
+    for(int n = 0; n < pins->count; n++)
+    {
+        if(pins->addr[n] == addr)
+        {
+            pins->count--;
+            pins->addr[n] = pins->addr[pins->count];
+            pins->value[n] = pins->value[pins->count];
+            return;
+        }
+    }
+}
+
+void
+apply_pins(const PinSet *pins, Chip8 *chip)
+{
+    for(int n = 0; n < pins->count; n++)
+        if(chip->memory[pins->addr[n]] != pins->value[n])
+            poke(chip, pins->addr[n], pins->value[n]);
+}
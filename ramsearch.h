@@ -0,0 +1,59 @@
+#ifndef RAMSEARCH_H
+#define RAMSEARCH_H
+
+#include <stdint.h>
+#include "chip8.h"
+
+/*
+    RAM search: finds the addresses holding a game variable by keeping
+    copies of memory taken across frames and narrowing a candidate set
+    with comparisons between them. A range filter looks at every step
+    between consecutive snapshots in the range, so "increased" means
+    the byte went up at least once and never went down.
+
+    Pins are addresses forced to a value, re-applied by the frame loop
+    after every frame through poke() so the state hash stays valid.
+*/
+
+#define RAM_SIZE 4096
+#define RAM_PINS 32
+
+typedef enum
+{
+    SEARCH_EQUAL,
+    SEARCH_CHANGED,
+    SEARCH_INCREASED,
+    SEARCH_DECREASED,
+    SEARCH_VALUE
+} SearchFilter;
+
+typedef struct
+{
+    uint8_t (*snapshots)[RAM_SIZE];
+    int count;
+    int capacity;
+    int mark;
+    int remaining;
+    _Alignas(64) uint8_t candidates[RAM_SIZE];
+} RamSearch;
+
+typedef struct
+{
+    int count;
+    uint16_t addr[RAM_PINS];
+    uint8_t value[RAM_PINS];
+} PinSet;
+
+void init_ram_search(RamSearch *search);
+void close_ram_search(RamSearch *search);
+int record_snapshot(RamSearch *search, const Chip8 *chip);
+void clear_snapshots(RamSearch *search);
+void reset_candidates(RamSearch *search);
+int filter_candidates(RamSearch *search, SearchFilter filter, int from, int to, uint8_t value);
+int next_candidate(const RamSearch *search, int addr);
+
+int pin_address(PinSet *pins, uint16_t addr, uint8_t value);
+void unpin_address(PinSet *pins, uint16_t addr);
+void apply_pins(const PinSet *pins, Chip8 *chip);
+
+#endif
@@ -5,12 +5,93 @@
 #define SCREEN_WIDTH (64 * SCREEN_SCALE)
 #define SCREEN_HEIGHT (32 * SCREEN_SCALE)
 
-void
-init_sdl(Platform *platform)
+#define AUDIO_RATE 48000
+#define AUDIO_BUFFER 512
+#define BEEP_HZ 440
+#define BEEP_VOLUME 3000
+
+static void
+audio_callback(void *userdata, Uint8 *stream, int len)
+{
+    Platform *platform = userdata;
+    int16_t *samples = (int16_t *)stream;
+    int count = len / (int)sizeof(int16_t);
+    int on = atomic_load(&platform->beeping);
+    uint32_t half_period = platform->audio_rate / (BEEP_HZ * 2);
+
+    for(int i = 0; i < count; i++)
+    {
+        if(on)
+            samples[i] = (platform->beep_phase < half_period) ? BEEP_VOLUME : -BEEP_VOLUME;
+        else
+            samples[i] = 0;
+
+        platform->beep_phase = (platform->beep_phase + 1) % (half_period * 2);
+    }
+
+    // count and stamp are published as a pair under the sequence, as monitor.c does for frames
+    uint32_t sequence = atomic_load_explicit(&platform->audio_sequence, memory_order_relaxed);
+    uint64_t played = atomic_load_explicit(&platform->audio_samples, memory_order_relaxed);
+
+    atomic_store_explicit(&platform->audio_sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    atomic_store_explicit(&platform->audio_samples, played + count, memory_order_relaxed);
+    atomic_store_explicit(&platform->audio_stamp, SDL_GetPerformanceCounter(), memory_order_relaxed);
+
+    atomic_store_explicit(&platform->audio_sequence, sequence + 2, memory_order_release);
+}
+
+static int
+open_audio(Platform *platform)
 {
+    SDL_AudioSpec want, have;
+
+    if(SDL_Init(SDL_INIT_AUDIO))
+        return -1;
+
+    memset(&want, 0, sizeof(want));
+    want.freq = AUDIO_RATE;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = AUDIO_BUFFER;
+    want.callback = audio_callback;
+    want.userdata = platform;
+
+    platform->audio = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+
+    if(!platform->audio)
+        return -1;
+
+    platform->audio_rate = have.freq;
+    platform->audio_buffer = have.samples;
+    SDL_PauseAudioDevice(platform->audio, 0);
+
+    return 0;
+}
+
+PaceMode
+init_sdl(Platform *platform, PaceMode pace)
+{
+    SDL_DisplayMode mode;
+
     platform->window = NULL;
     platform->renderer = NULL;
     platform->texture = NULL;
+    platform->refresh_rate = 60;
+    platform->audio = 0;
+    platform->beep_phase = 0;
+    atomic_init(&platform->audio_samples, 0);
+    atomic_init(&platform->audio_stamp, 0);
+    atomic_init(&platform->audio_sequence, 0);
+    atomic_init(&platform->beeping, 0);
+    memset(&platform->input_stats, 0, sizeof(platform->input_stats));
+
+    if(pace == PACE_AUDIO && open_audio(platform))
+    {
+        perror("Audio device could not be opened, pacing by timer");
+        pace = PACE_TIMER;
+    }
 
     platform->window = SDL_CreateWindow("Chip-8 Emulator", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
                                         SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN);
@@ -18,27 +99,125 @@ init_sdl(Platform *platform)
     if(!platform->window)
     {
         perror("Window could not be created");
-        return;
+        return pace;
     }
 
-    platform->renderer = SDL_CreateRenderer(platform->window, -1, SDL_RENDERER_ACCELERATED);
+    if(SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(platform->window), &mode) == 0 &&
+       mode.refresh_rate > 0)
+        platform->refresh_rate = mode.refresh_rate;
+
+    platform->renderer = SDL_CreateRenderer(platform->window, -1, SDL_RENDERER_ACCELERATED |
+                                            (pace == PACE_VSYNC ? SDL_RENDERER_PRESENTVSYNC : 0));
 
     if(!platform->renderer)
     {
         perror("Renderer could not be created");
-        return;
+        return pace;
     }
 
     platform->texture = SDL_CreateTexture(platform->renderer, SDL_PIXELFORMAT_RGBA8888, 
                                           SDL_TEXTUREACCESS_STREAMING, 64, 32);
+
+    return pace;
+}
+
+/*
+    Seconds of audio the device has played. Samples are counted when the
+    callback hands them over, and the device then drains that buffer at
+    a steady rate until the next callback, so the clock interpolates
+    across the buffer with the performance counter, but never past it.
+    The pair is read under the callback's sequence counter and read
+    again if the callback was writing it meanwhile.
+*/
+
+double
+audio_clock(Platform *platform)
+{
+    uint64_t samples, stamp;
+    uint32_t sequence;
+
+    do
+    {
+        sequence = atomic_load_explicit(&platform->audio_sequence, memory_order_acquire);
+        samples = atomic_load_explicit(&platform->audio_samples, memory_order_relaxed);
+        stamp = atomic_load_explicit(&platform->audio_stamp, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+    } while((sequence & 1) || atomic_load_explicit(&platform->audio_sequence, memory_order_relaxed) != sequence);
+
+    double buffer = (double)platform->audio_buffer / platform->audio_rate;
+    double since = (double)(SDL_GetPerformanceCounter() - stamp) / SDL_GetPerformanceFrequency();
+
+    if(since > buffer)
+        since = buffer;
+
+    return (double)samples / platform->audio_rate - buffer + since;
+}
+
+void
+set_beeper(Platform *platform, int on)
+{
+    atomic_store(&platform->beeping, on);
+}
+
+static void
+record_press(InputStats *stats, Chip8 *chip, int key, uint32_t timestamp)
+{
+    uint16_t bit = 1 << key;
+
+    // a press still waiting to be read keeps its original stamp
+    if(stats->pending & bit)
+        return;
+
+    stats->pending |= bit;
+    stats->press_cycles[key] = chip->cycles;
+    stats->press_ticks[key] = timestamp;
+    chip->key_watch |= bit;
+}
+
+// completes the pending presses the ROM has read since the last poll
+static void
+record_reads(InputStats *stats, Chip8 *chip)
+{
+    uint16_t read = stats->pending & ~chip->key_watch;
+    uint32_t now = SDL_GetTicks();
+
+    for(int k = 0; read && k < 16; k++)
+    {
+        if(!(read & (1 << k)))
+            continue;
+
+        uint32_t instructions = chip->key_read_at[k] - (uint32_t)stats->press_cycles[k];
+        uint32_t ms = now - stats->press_ticks[k];
+
+        // a netplay rollback can restore a machine from before the press; watch again
+        if(instructions > chip->cycles - stats->press_cycles[k])
+        {
+            chip->key_watch |= 1 << k;
+            read &= ~(1 << k);
+            continue;
+        }
+
+        stats->presses++;
+        stats->total_instructions += instructions;
+        stats->total_ms += ms;
+
+        if(instructions > stats->max_instructions)
+            stats->max_instructions = instructions;
+        if(ms > stats->max_ms)
+            stats->max_ms = ms;
+    }
+
+    stats->pending &= ~read;
 }
 
 int
-handle_input(Chip8 *chip)
+handle_input(Platform *platform, Chip8 *chip)
 {
     int quit = 0;
     SDL_Event e;
 
+    record_reads(&platform->input_stats, chip);
+
     while(SDL_PollEvent(&e))
     {
         if(e.type == SDL_QUIT)
@@ -46,50 +225,81 @@ handle_input(Chip8 *chip)
         else if(e.type == SDL_KEYDOWN || e.type == SDL_KEYUP)
         {
             uint8_t state = (e.type == SDL_KEYDOWN) ? 1 : 0;
+            int key;
 
             switch(e.key.keysym.sym)
             {
-                case SDLK_1: chip->keypad[0x1] = state; break;
-                case SDLK_2: chip->keypad[0x2] = state; break;
-                case SDLK_3: chip->keypad[0x3] = state; break;
-                case SDLK_4: chip->keypad[0xC] = state; break;
-                case SDLK_q: chip->keypad[0x4] = state; break;
-                case SDLK_w: chip->keypad[0x5] = state; break;
-                case SDLK_e: chip->keypad[0x6] = state; break;
-                case SDLK_r: chip->keypad[0xD] = state; break;
-                case SDLK_a: chip->keypad[0x7] = state; break;
-                case SDLK_s: chip->keypad[0x8] = state; break;
-                case SDLK_d: chip->keypad[0x9] = state; break;
-                case SDLK_f: chip->keypad[0xE] = state; break;
-                case SDLK_z: chip->keypad[0xA] = state; break;
-                case SDLK_x: chip->keypad[0x0] = state; break;
-                case SDLK_c: chip->keypad[0xB] = state; break;
-                case SDLK_v: chip->keypad[0xF] = state; break;
-                default: break;
+                case SDLK_1: key = 0x1; break;
+                case SDLK_2: key = 0x2; break;
+                case SDLK_3: key = 0x3; break;
+                case SDLK_4: key = 0xC; break;
+                case SDLK_q: key = 0x4; break;
+                case SDLK_w: key = 0x5; break;
+                case SDLK_e: key = 0x6; break;
+                case SDLK_r: key = 0xD; break;
+                case SDLK_a: key = 0x7; break;
+                case SDLK_s: key = 0x8; break;
+                case SDLK_d: key = 0x9; break;
+                case SDLK_f: key = 0xE; break;
+                case SDLK_z: key = 0xA; break;
+                case SDLK_x: key = 0x0; break;
+                case SDLK_c: key = 0xB; break;
+                case SDLK_v: key = 0xF; break;
+                default: continue;
             }
+
+            chip->keypad[key] = state;
+
+            if(state && !e.key.repeat)
+                record_press(&platform->input_stats, chip, key, e.key.timestamp);
         }
     }
 
     return quit;
 }
 
+void
+print_input_stats(Platform *platform)
+{
+    InputStats *stats = &platform->input_stats;
+
+    if(!stats->presses)
+        return;
+
+    fprintf(stderr, "input latency: %llu presses read, avg %.1f / max %u instructions, avg %.1f / max %u ms\n",
+            (unsigned long long)stats->presses,
+            (double)stats->total_instructions / stats->presses,
+            stats->max_instructions,
+            (double)stats->total_ms / stats->presses,
+            stats->max_ms);
+}
+
 void
 render_screen(Platform *platform, Chip8 *chip)
 {
     uint32_t pixels[32 * 64];
     
     for (int i = 0; i < 32 * 64; i++) {
-        pixels[i] = (chip->display[i]) ? 0xFFFFFFFF : 0x000000FF;
+        pixels[i] = chip8_pixel(chip->framebuffer, i % 64, i / 64) ? 0xFFFFFFFF : 0x000000FF;
     }
     
     SDL_UpdateTexture(platform->texture, NULL, pixels, 64 * sizeof(uint32_t));
     SDL_RenderCopy(platform->renderer, platform->texture, NULL, NULL);
+}
+
+void
+present_screen(Platform *platform)
+{
     SDL_RenderPresent(platform->renderer);
 }
 
 
 void close_sdl(Platform *platform)
 {
+    if(platform->audio)
+        SDL_CloseAudioDevice(platform->audio);
+    platform->audio = 0;
+
     SDL_DestroyWindow(platform->window);
     platform->window = NULL;
     SDL_DestroyRenderer(platform->renderer);
@@ -2,18 +2,67 @@
 #define SDL_H
 
 #include <SDL2/SDL.h>
+#include <stdatomic.h>
 #include "chip8.h"
 
+typedef enum
+{
+    PACE_TIMER,
+    PACE_VSYNC,
+    PACE_AUDIO
+} PaceMode;
+
+/*
+    Key press latency, up to the first instruction that reads the key
+    (Ex9E, ExA1 or Fx0A). Instructions are counted from the slice the
+    press was applied in, so they are exact; wall time runs from the OS
+    event timestamp to the first poll after the read, so it is only as
+    fine as the poll interval. Presses the ROM never reads are not
+    counted.
+*/
+
+typedef struct
+{
+    uint16_t pending;
+    uint64_t press_cycles[16];
+    uint32_t press_ticks[16];
+    uint64_t presses;
+    uint64_t total_instructions;
+    uint32_t max_instructions;
+    uint64_t total_ms;
+    uint32_t max_ms;
+} InputStats;
+
 typedef struct
 {
     SDL_Window *window;
     SDL_Renderer *renderer;
     SDL_Texture *texture;
+    InputStats input_stats;
+    int refresh_rate;
+
+    /*
+        Audio clock, written by the audio callback: the number of samples
+        the device has consumed and the performance counter at the time,
+        published together under audio_sequence, which is odd mid-write.
+    */
+    SDL_AudioDeviceID audio;
+    int audio_rate;
+    int audio_buffer;
+    _Atomic uint64_t audio_samples;
+    _Atomic uint64_t audio_stamp;
+    atomic_uint audio_sequence;
+    atomic_int beeping;
+    uint32_t beep_phase;
 } Platform;
 
-void init_sdl(Platform *platform);
-int handle_input(Chip8 *chip);
+PaceMode init_sdl(Platform *platform, PaceMode pace);
+double audio_clock(Platform *platform);
+void set_beeper(Platform *platform, int on);
+int handle_input(Platform *platform, Chip8 *chip);
+void print_input_stats(Platform *platform);
 void render_screen(Platform *platform, Chip8 *chip);
+void present_screen(Platform *platform);
 void close_sdl(Platform *platform);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,252 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "libchip8.h"
+#include "ramsearch.h"
+
+/*
+    chip8-search: headless RAM search. Runs a ROM with scripted input,
+    records memory after every frame and narrows down the addresses of
+    a variable with filters between snapshots. Commands come from the
+    command line, one per argument, or from stdin one per line:
+
+        run N [KEYS]       run N frames holding the hex key mask KEYS
+        record on|off      snapshot after every frame (default on)
+        snap               take one snapshot now
+        filter OP [A B]    OP is equal, changed, increased or decreased,
+                           over snapshots A..B (default: since the last filter)
+        filter value V [A] keep addresses holding V in snapshot A (default: latest)
+        list [N]           show up to N candidates with their recent values
+        reset              make every address a candidate again
+        clear              drop all snapshots
+        pin ADDR VALUE     hold ADDR at VALUE, re-applied after every frame
+        unpin ADDR
+        peek ADDR
+*/
+
+#define HISTORY 8
+
+typedef struct
+{
+    Chip8 *chip;
+    RamSearch search;
+    PinSet pins;
+    int recording;
+    long frame;
+} Session;
+
+static double
+now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void
+run_frames(Session *session, long frames, uint16_t keys)
+{
+    for(long n = 0; n < frames; n++)
+    {
+        chip8_step_frames(session->chip, 1, keys);
+        apply_pins(&session->pins, session->chip);
+        session->frame++;
+
+        if(session->recording && record_snapshot(&session->search, session->chip))
+            return;
+    }
+
+    printf("frame %ld, %d snapshots\n", session->frame, session->search.count);
+}
+
+static void
+list_candidates(const Session *session, int limit)
+{
+    const RamSearch *search = &session->search;
+    int shown = 0;
+
+    printf("%d candidates\n", search->remaining);
+
+    for(int addr = next_candidate(search, 0); addr >= 0 && shown < limit; addr = next_candidate(search, addr + 1))
+    {
+        printf("  0x%03X  %02X  ", addr, session->chip->memory[addr]);
+
+        for(int s = search->count > HISTORY ? search->count - HISTORY : 0; s < search->count; s++)
+            printf(" %02X", search->snapshots[s][addr]);
+
+        printf("\n");
+        shown++;
+    }
+}
+
+static int
+parse_filter(const char *name, SearchFilter *filter)
+{
+    static const char *names[] = { "equal", "changed", "increased", "decreased", "value" };
+
+    for(int n = 0; n < 5; n++)
+    {
+        if(strcmp(name, names[n]) == 0)
+        {
+            *filter = (SearchFilter)n;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static void
+run_filter(Session *session, char **args, int count)
+{
+    SearchFilter filter;
+
+    if(count < 2 || parse_filter(args[1], &filter))
+    {
+        printf("filter equal|changed|increased|decreased [A B] or filter value V [A]\n");
+        return;
+    }
+
+    int from = -1, to = -1, value = 0;
+
+    if(filter == SEARCH_VALUE)
+    {
+        if(count < 3)
+        {
+            printf("filter value needs a value\n");
+            return;
+        }
+
+        value = (int)strtol(args[2], NULL, 0);
+        if(count > 3)
+            from = to = atoi(args[3]);
+    }
+    else if(count > 3)
+    {
+        from = atoi(args[2]);
+        to = atoi(args[3]);
+    }
+
+    int before = session->search.remaining;
+    double start = now_ms();
+    int left = filter_candidates(&session->search, filter, from, to, (uint8_t)value);
+
+    if(left < 0)
+        printf("not enough snapshots in that range\n");
+    else
+        printf("%d -> %d candidates (%.3f ms)\n", before, left, now_ms() - start);
+}
+
+static int
+run_command(Session *session, char *line)
+{
+    char *args[8];
+    int count = 0;
+
+    for(char *token = strtok(line, " \t\r\n"); token && count < 8; token = strtok(NULL, " \t\r\n"))
+        args[count++] = token;
+
+    if(count == 0 || args[0][0] == '#')
+        return 0;
+
+    if(strcmp(args[0], "run") == 0 && count > 1)
+        run_frames(session, atol(args[1]), count > 2 ? (uint16_t)strtol(args[2], NULL, 16) : 0);
+    else if(strcmp(args[0], "record") == 0 && count > 1)
+        session->recording = strcmp(args[1], "off") != 0;
+    else if(strcmp(args[0], "snap") == 0)
+        record_snapshot(&session->search, session->chip);
+    else if(strcmp(args[0], "filter") == 0)
+        run_filter(session, args, count);
+    else if(strcmp(args[0], "list") == 0)
+        list_candidates(session, count > 1 ? atoi(args[1]) : 20);
+    else if(strcmp(args[0], "reset") == 0)
+        reset_candidates(&session->search);
+    else if(strcmp(args[0], "clear") == 0)
+        clear_snapshots(&session->search);
+    else if(strcmp(args[0], "pin") == 0 && count > 2)
+    {
+        if(pin_address(&session->pins, (uint16_t)strtol(args[1], NULL, 16), (uint8_t)strtol(args[2], NULL, 0)))
+            printf("at most %d pins\n", RAM_PINS);
+        apply_pins(&session->pins, session->chip);
+    }
+    else if(strcmp(args[0], "unpin") == 0 && count > 1)
+        unpin_address(&session->pins, (uint16_t)strtol(args[1], NULL, 16));
+    else if(strcmp(args[0], "peek") == 0 && count > 1)
+    {
+        int addr = (int)strtol(args[1], NULL, 16) & (RAM_SIZE - 1);
+        printf("0x%03X = %02X\n", addr, session->chip->memory[addr]);
+    }
+    else if(strcmp(args[0], "quit") == 0)
+        return 1;
+    else
+        printf("unknown command: %s\n", args[0]);
+
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    if(argc < 2)
+    {
+        fprintf(stderr, "usage: %s rom [command ...]\n"
+                        "without commands, reads them from stdin; see search.c for the list\n", argv[0]);
+        return 1;
+    }
+
+    uint8_t rom[MAX_ROM_SIZE];
+    FILE *input = fopen(argv[1], "rb");
+
+    if(!input)
+    {
+        perror("could not open rom");
+        return 1;
+    }
+
+    size_t size = fread(rom, 1, sizeof(rom), input);
+    fclose(input);
+
+    Session session = { 0 };
+    session.chip = chip8_create();
+    session.recording = 1;
+
+    if(!session.chip)
+    {
+        perror("could not create machine");
+        return 1;
+    }
+
+    chip8_reset(session.chip, rom, size, 1);
+    init_ram_search(&session.search);
+    record_snapshot(&session.search, session.chip);
+
+    if(argc > 2)
+    {
+        for(int i = 2; i < argc; i++)
+        {
+            char line[256];
+
+            snprintf(line, sizeof(line), "%s", argv[i]);
+            if(run_command(&session, line))
+                break;
+        }
+    }
+    else
+    {
+        char line[256];
+
+        while(fgets(line, sizeof(line), stdin))
+            if(run_command(&session, line))
+                break;
+    }
+
+    close_ram_search(&session.search);
+    chip8_destroy(session.chip);
+
+    return 0;
+}
@@ -0,0 +1,511 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "server.h"
+
+/*
+    One thread, one epoll set. Every readable connection is drained,
+    each complete message is executed in place and its reply appended
+    to the connection's output buffer, which is flushed before waiting
+    again. EPOLLOUT is only requested while a reply is still pending.
+*/
+
+#define MAX_EVENTS 64
+
+static volatile sig_atomic_t stopping = 0;
+
+void
+stop_server(int sig)
+{
+    (void)sig;
+    stopping = 1;
+}
+
+static int
+reserve(uint8_t **buf, size_t *cap, size_t need)
+{
+    if(need <= *cap)
+        return 0;
+
+    size_t new_cap = *cap ? *cap : 4096;
+
+    while(new_cap < need)
+        new_cap *= 2;
+
+    uint8_t *grown = realloc(*buf, new_cap);
+
+    if(!grown)
+        return -1;
+
+    *buf = grown;
+    *cap = new_cap;
+
+    return 0;
+}
+
+static int
+set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+int
+init_server(Server *server, const char *path)
+{
+    memset(server, 0, sizeof(*server));
+    server->path = path;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if(strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "socket path too long: %s\n", path);
+        return -1;
+    }
+
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if(server->listen_fd < 0 || bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+       listen(server->listen_fd, 128) < 0 || set_nonblocking(server->listen_fd) < 0)
+    {
+        perror("Socket could not be opened");
+        return -1;
+    }
+
+    server->epoll_fd = epoll_create1(0);
+
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = NULL };
+
+    if(server->epoll_fd < 0 || epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->listen_fd, &event) < 0)
+    {
+        perror("epoll could not be set up");
+        return -1;
+    }
+
+    return 0;
+}
+
+static Session *
+get_session(Server *server, uint16_t id)
+{
+    return (id < MAX_SESSIONS) ? server->sessions[id] : NULL;
+}
+
+static int
+create_session(Server *server)
+{
+    for(int n = 0; n < MAX_SESSIONS; n++)
+    {
+        int id = (server->session_hint + n) % MAX_SESSIONS;
+
+        if(server->sessions[id])
+            continue;
+
+        Session *session = calloc(1, sizeof(Session));
+
+        if(!session)
+            return -1;
+
+        reset(&session->chip, NULL, 0);
+        server->sessions[id] = session;
+        server->session_hint = id + 1;
+
+        return id;
+    }
+
+    return -1;
+}
+
+static void
+destroy_session(Server *server, uint16_t id)
+{
+    free(server->sessions[id]->snapshot);
+    free(server->sessions[id]);
+    server->sessions[id] = NULL;
+}
+
+static uint8_t *
+add_result(Connection *conn, uint8_t status, uint16_t session, uint32_t len)
+{
+    if(reserve(&conn->out, &conn->out_cap, conn->out_len + RESULT_HEADER_SIZE + len))
+        return NULL;
+
+    uint8_t *p = conn->out + conn->out_len;
+
+    p[0] = status;
+    p[1] = 0;
+    put16(p + 2, session);
+    put32(p + 4, len);
+    conn->out_len += RESULT_HEADER_SIZE + len;
+
+    return p + RESULT_HEADER_SIZE;
+}
+
+static void
+set_keys(Chip8 *chip, uint32_t mask)
+{
+    for(int k = 0; k < 16; k++)
+        chip->keypad[k] = (mask >> k) & 1;
+}
+
+static void
+run_session(Session *session, uint8_t op, uint32_t arg)
+{
+    switch(op)
+    {
+        case OP_KEYS:
+            set_keys(&session->chip, arg);
+            break;
+
+        case OP_STEP:
+            for(uint32_t n = 0; n < arg; n++)
+                cycle(&session->chip);
+            break;
+
+        case OP_FRAMES:
+            for(uint32_t n = 0; n < arg; n++)
+                step_frame(&session->chip);
+            break;
+    }
+}
+
+static void
+pack_display(const Chip8 *chip, uint8_t *out)
+{
+    for(int y = 0; y < 32; y++)
+        for(int b = 0; b < 8; b++)
+            *out++ = chip->framebuffer[y] >> (56 - b * 8);
+}
+
+static void
+pack_registers(const Chip8 *chip, uint8_t *out)
+{
+    memcpy(out, chip->v, 16);
+    put16(out + 16, chip->i);
+    put16(out + 18, chip->pc);
+    out[20] = chip->sp;
+    out[21] = chip->delay_timer;
+    out[22] = chip->sound_timer;
+    out[23] = 0;
+    put32(out + 24, (uint32_t)chip->cycles);
+    put32(out + 28, (uint32_t)(chip->cycles >> 32));
+
+    for(int n = 0; n < 16; n++)
+        put16(out + 32 + n * 2, chip->stack[n]);
+
+    // unknown opcodes are only counted, so a client ROM cannot flood the server's stderr
+    put32(out + 64, chip->unknown_opcodes);
+}
+
+static void
+execute_command(Server *server, Connection *conn, uint8_t op, uint16_t id,
+                uint32_t arg, const uint8_t *payload)
+{
+    if(op == OP_CREATE)
+    {
+        int created = create_session(server);
+
+        add_result(conn, (created < 0) ? STATUS_FULL : STATUS_OK, (created < 0) ? ALL_SESSIONS : created, 0);
+        return;
+    }
+
+    if((op == OP_STEP && arg > MAX_STEP) || (op == OP_FRAMES && arg > MAX_FRAMES))
+    {
+        add_result(conn, STATUS_BAD_REQUEST, id, 0);
+        return;
+    }
+
+    if(id == ALL_SESSIONS && (op == OP_KEYS || op == OP_STEP || op == OP_FRAMES))
+    {
+        for(int n = 0; n < MAX_SESSIONS; n++)
+            if(server->sessions[n])
+                run_session(server->sessions[n], op, arg);
+
+        add_result(conn, STATUS_OK, id, 0);
+        return;
+    }
+
+    Session *session = get_session(server, id);
+
+    if(!session)
+    {
+        add_result(conn, STATUS_BAD_SESSION, id, 0);
+        return;
+    }
+
+    uint8_t *out;
+
+    switch(op)
+    {
+        case OP_DESTROY:
+            destroy_session(server, id);
+            break;
+
+        case OP_LOAD:
+            if(arg > MAX_ROM_SIZE)
+            {
+                add_result(conn, STATUS_BAD_REQUEST, id, 0);
+                return;
+            }
+            reset(&session->chip, payload, arg);
+            break;
+
+        case OP_KEYS:
+        case OP_STEP:
+        case OP_FRAMES:
+            run_session(session, op, arg);
+            break;
+
+        case OP_DISPLAY:
+            if((out = add_result(conn, STATUS_OK, id, DISPLAY_PAYLOAD_SIZE)))
+                pack_display(&session->chip, out);
+            return;
+
+        case OP_REGS:
+            if((out = add_result(conn, STATUS_OK, id, REGS_PAYLOAD_SIZE)))
+                pack_registers(&session->chip, out);
+            return;
+
+        case OP_SAVE:
+            if(!session->snapshot && !(session->snapshot = malloc(sizeof(Chip8))))
+            {
+                add_result(conn, STATUS_FULL, id, 0);
+                return;
+            }
+            *session->snapshot = session->chip;
+            break;
+
+        case OP_RESTORE:
+            if(!session->snapshot)
+            {
+                add_result(conn, STATUS_NO_SNAPSHOT, id, 0);
+                return;
+            }
+            session->chip = *session->snapshot;
+            break;
+
+        default:
+            add_result(conn, STATUS_BAD_REQUEST, id, 0);
+            return;
+    }
+
+    add_result(conn, STATUS_OK, id, 0);
+}
+
+static int
+process_message(Server *server, Connection *conn, const uint8_t *msg, size_t size)
+{
+    if(size < 2 || reserve(&conn->out, &conn->out_cap, conn->out_len + MESSAGE_HEADER_SIZE))
+        return -1;
+
+    size_t reply = conn->out_len;
+    conn->out_len += MESSAGE_HEADER_SIZE;
+
+    uint16_t count = get16(msg);
+    const uint8_t *p = msg + 2;
+    const uint8_t *end = msg + size;
+    uint16_t results = 0;
+
+    while(results < count && end - p >= COMMAND_HEADER_SIZE)
+    {
+        uint8_t op = p[0];
+        uint16_t id = get16(p + 2);
+        uint32_t arg = get32(p + 4);
+        uint32_t payload_len = (op == OP_LOAD) ? arg : 0;
+
+        p += COMMAND_HEADER_SIZE;
+        results++;
+
+        if(payload_len > (size_t)(end - p))
+        {
+            add_result(conn, STATUS_BAD_REQUEST, id, 0);
+            break;
+        }
+
+        execute_command(server, conn, op, id, arg, p);
+        p += payload_len;
+    }
+
+    put32(conn->out + reply, conn->out_len - reply - 4);
+    put16(conn->out + reply + 4, results);
+
+    return 0;
+}
+
+static void
+close_connection(Server *server, Connection *conn)
+{
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    free(conn->in);
+    free(conn->out);
+    free(conn);
+}
+
+static int
+flush_connection(Server *server, Connection *conn)
+{
+    while(conn->out_sent < conn->out_len)
+    {
+        ssize_t n = send(conn->fd, conn->out + conn->out_sent, conn->out_len - conn->out_sent, MSG_NOSIGNAL);
+
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return -1;
+        }
+
+        conn->out_sent += n;
+    }
+
+    int pending = conn->out_sent < conn->out_len;
+
+    if(!pending)
+        conn->out_len = conn->out_sent = 0;
+
+    if(pending != conn->writing)
+    {
+        struct epoll_event event = { .events = EPOLLIN | (pending ? EPOLLOUT : 0), .data.ptr = conn };
+
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+        conn->writing = pending;
+    }
+
+    return 0;
+}
+
+static int
+read_connection(Server *server, Connection *conn)
+{
+    for(;;)
+    {
+        if(reserve(&conn->in, &conn->in_cap, conn->in_len + 65536))
+            return -1;
+
+        ssize_t n = read(conn->fd, conn->in + conn->in_len, conn->in_cap - conn->in_len);
+
+        if(n == 0)
+            return -1;
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return -1;
+        }
+
+        conn->in_len += n;
+    }
+
+    size_t offset = 0;
+
+    while(conn->in_len - offset >= 4)
+    {
+        uint32_t size = get32(conn->in + offset);
+
+        if(size > MAX_MESSAGE_SIZE)
+            return -1;
+        if(conn->in_len - offset - 4 < size)
+            break;
+
+        if(process_message(server, conn, conn->in + offset + 4, size))
+            return -1;
+
+        offset += 4 + size;
+    }
+
+    memmove(conn->in, conn->in + offset, conn->in_len - offset);
+    conn->in_len -= offset;
+
+    return flush_connection(server, conn);
+}
+
+static void
+accept_connections(Server *server)
+{
+    for(;;)
+    {
+        int fd = accept(server->listen_fd, NULL, NULL);
+
+        if(fd < 0)
+            return;
+
+        Connection *conn = calloc(1, sizeof(Connection));
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = conn };
+
+        if(!conn || set_nonblocking(fd) < 0 || epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+        {
+            free(conn);
+            close(fd);
+            continue;
+        }
+
+        conn->fd = fd;
+    }
+}
+
+void
+run_server(Server *server)
+{
+    struct epoll_event events[MAX_EVENTS];
+
+    while(!stopping)
+    {
+        int count = epoll_wait(server->epoll_fd, events, MAX_EVENTS, -1);
+
+        for(int n = 0; n < count; n++)
+        {
+            Connection *conn = events[n].data.ptr;
+
+            if(!conn)
+            {
+                accept_connections(server);
+                continue;
+            }
+
+            int failed = 0;
+
+            if(events[n].events & (EPOLLERR | EPOLLHUP))
+                failed = 1;
+            if(!failed && (events[n].events & EPOLLIN))
+                failed = read_connection(server, conn);
+            if(!failed && (events[n].events & EPOLLOUT))
+                failed = flush_connection(server, conn);
+
+            if(failed)
+                close_connection(server, conn);
+        }
+    }
+}
+
+void
+close_server(Server *server)
+{
+    for(int id = 0; id < MAX_SESSIONS; id++)
+        if(server->sessions[id])
+            destroy_session(server, id);
+
+    close(server->epoll_fd);
+    close(server->listen_fd);
+    unlink(server->path);
+}
@@ -0,0 +1,42 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "chip8.h"
+#include "protocol.h"
+
+typedef struct
+{
+    Chip8 chip;
+    Chip8 *snapshot;
+} Session;
+
+typedef struct
+{
+    int fd;
+    uint8_t *in;
+    size_t in_len;
+    size_t in_cap;
+    uint8_t *out;
+    size_t out_len;
+    size_t out_cap;
+    size_t out_sent;
+    int writing;
+} Connection;
+
+typedef struct
+{
+    int listen_fd;
+    int epoll_fd;
+    const char *path;
+    Session *sessions[MAX_SESSIONS];
+    int session_hint;
+} Server;
+
+int init_server(Server *server, const char *path);
+void run_server(Server *server);
+void stop_server(int sig);
+void close_server(Server *server);
+
+#endif
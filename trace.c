@@ -0,0 +1,253 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include "trace.h"
+
+/*
+    The ring is single-producer, single-consumer. The emulating thread
+    owns head and keeps its own copy of tail, reloading it only when the
+    ring looks full, so a record normally costs one 16-byte store and a
+    release store of head. The drain thread writes the ring out in the
+    largest contiguous runs it can.
+*/
+
+#define DRAIN_IDLE_NS 1000000L
+
+/*
+    What each instruction writes, indexed by its top nibble and low
+    byte. Reading v[] back as wide words to diff it would stall on the
+    byte store cycle() just made, so the destination comes from the
+    opcode instead, and only the bytes it names are loaded.
+*/
+
+#define EFFECT_WAITS 0x01
+#define EFFECT_BCD   0x40
+#define EFFECT_REGS  0x80
+
+static uint8_t effects[16 * 256];
+static pthread_once_t effects_once = PTHREAD_ONCE_INIT;
+
+static void
+build_effects(void)
+{
+    for(int msb = 0; msb < 16; msb++)
+    {
+        for(int low = 0; low < 256; low++)
+        {
+            uint8_t effect = 0;
+
+            if(msb == 0x6 || msb == 0x7 || msb == 0xC)
+                effect = TRACE_V;
+            else if(msb == 0x8 && ((low & 0x0F) <= 0x3))
+                effect = TRACE_V;
+            else if(msb == 0x8 && ((low & 0x0F) <= 0x7 || (low & 0x0F) == 0xE))
+                effect = TRACE_V | TRACE_VF;
+            else if(msb == 0xD)
+                effect = TRACE_VF;
+            else if(msb == 0xF && (low == 0x07 || low == 0x65))
+                effect = TRACE_V;
+            else if(msb == 0xF && low == 0x0A)
+                effect = TRACE_V | EFFECT_WAITS;
+            else if(msb == 0xF && low == 0x33)
+                effect = EFFECT_BCD;
+            else if(msb == 0xF && low == 0x55)
+                effect = EFFECT_REGS;
+
+            effects[msb << 8 | low] = effect;
+        }
+    }
+}
+
+static int
+write_all(int fd, const void *data, size_t size)
+{
+    const uint8_t *bytes = data;
+
+    while(size > 0)
+    {
+        ssize_t written = write(fd, bytes, size);
+
+        if(written < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        bytes += written;
+        size -= written;
+    }
+
+    return 0;
+}
+
+static void *
+drain_trace(void *arg)
+{
+    Tracer *tracer = arg;
+    struct timespec idle = { 0, DRAIN_IDLE_NS };
+
+    for(;;)
+    {
+        // read stop first, so everything pushed before it was set gets written
+        int stopping = atomic_load(&tracer->stop);
+        uint64_t head = atomic_load_explicit(&tracer->head, memory_order_acquire);
+        uint64_t tail = atomic_load_explicit(&tracer->tail, memory_order_relaxed);
+
+        if(head == tail)
+        {
+            if(stopping)
+                break;
+
+            nanosleep(&idle, NULL);
+            continue;
+        }
+
+        size_t first = tail & (TRACE_RING - 1);
+        size_t count = head - tail;
+
+        if(count > TRACE_RING - first)
+            count = TRACE_RING - first;
+
+        // after a write error records are still consumed, so the emulator never blocks
+        if(!tracer->failed && write_all(tracer->fd, &tracer->ring[first], count * sizeof(TraceRecord)))
+        {
+            perror("could not write trace");
+            tracer->failed = 1;
+        }
+
+        atomic_store_explicit(&tracer->tail, tail + count, memory_order_release);
+    }
+
+    return NULL;
+}
+
+int
+open_trace(Tracer *tracer, const char *path, uint64_t start)
+{
+    TraceHeader header = { "C8TRACE", TRACE_VERSION, sizeof(TraceRecord), start };
+
+    pthread_once(&effects_once, build_effects);
+    memset(tracer, 0, sizeof(*tracer));
+
+    tracer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if(tracer->fd < 0)
+    {
+        perror("could not open trace");
+        return -1;
+    }
+
+    tracer->ring = malloc(TRACE_RING * sizeof(TraceRecord));
+
+    if(!tracer->ring || write_all(tracer->fd, &header, sizeof(header)))
+    {
+        perror("could not start trace");
+        free(tracer->ring);
+        close(tracer->fd);
+        return -1;
+    }
+
+    if(pthread_create(&tracer->thread, NULL, drain_trace, tracer))
+    {
+        perror("could not start trace writer");
+        free(tracer->ring);
+        close(tracer->fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+wait_for_space(Tracer *tracer, uint64_t end)
+{
+    for(;;)
+    {
+        tracer->cached_tail = atomic_load_explicit(&tracer->tail, memory_order_acquire);
+
+        if(end - tracer->cached_tail <= TRACE_RING)
+            return;
+
+        tracer->stalls++;
+        sched_yield();
+    }
+}
+
+static inline void
+record_instruction(TraceRecord *out, Chip8 *chip)
+{
+    TraceRecord record;
+    uint16_t opcode = (chip->memory[chip->pc & 0xFFF] << 8) | chip->memory[(chip->pc + 1) & 0xFFF];
+    uint8_t effect = effects[(opcode >> 12) << 8 | (opcode & 0xFF)];
+    int x = (opcode & 0x0F00) >> 8;
+    uint16_t addr = chip->i;
+
+    record.pc = chip->pc;
+    record.opcode = opcode;
+
+    cycle(chip);
+
+    // Fx0A that is still waiting for a key has written nothing
+    int wrote = (effect & TRACE_V) != 0;
+
+    if(effect & EFFECT_WAITS)
+        wrote &= chip->pc != record.pc;
+
+    record.count = (uint32_t)chip->cycles;
+    record.i = chip->i;
+    record.reg = (effect & TRACE_VF) | ((TRACE_V | x) & -wrote);
+    record.value = chip->v[x] & -wrote;
+    record.writes = (effect & EFFECT_BCD) ? 3 : (effect & EFFECT_REGS) ? x + 1 : 0;
+    record.addr = record.writes ? addr : 0;
+    record.vf = chip->v[15];
+
+    *out = record;
+}
+
+/*
+    Room for the whole run is reserved up front and head is published
+    once at the end, so the loop itself touches no shared state.
+*/
+
+void
+trace_cycles(Tracer *tracer, Chip8 *chip, int count)
+{
+    uint64_t head = atomic_load_explicit(&tracer->head, memory_order_relaxed);
+    TraceRecord *ring = tracer->ring;
+
+    if(head + count - tracer->cached_tail > TRACE_RING)
+        wait_for_space(tracer, head + count);
+
+    for(int n = 0; n < count; n++)
+        record_instruction(&ring[(head + n) & (TRACE_RING - 1)], chip);
+
+    atomic_store_explicit(&tracer->head, head + count, memory_order_release);
+}
+
+/*
+    Waits for the writer to drain the ring, then closes the file.
+    Returns the number of records traced.
+*/
+
+uint64_t
+close_trace(Tracer *tracer)
+{
+    atomic_store(&tracer->stop, 1);
+    pthread_join(tracer->thread, NULL);
+
+    if(close(tracer->fd))
+        perror("could not write trace");
+
+    free(tracer->ring);
+    tracer->ring = NULL;
+
+    return atomic_load(&tracer->head);
+}
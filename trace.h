@@ -0,0 +1,78 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "chip8.h"
+
+/*
+    Binary execution trace: one fixed 16-byte record per instruction,
+    after a 24-byte header. All fields are little-endian, so another
+    engine can emit the same format and chip8-trace can diff the two.
+
+        header  "C8TRACE\0", u32 version, u32 record size,
+                u64 instruction count before the first record
+        record  u32 instruction count after it (low 32 bits)
+                u16 pc, u16 opcode, u16 I after the instruction
+                u8  register written: TRACE_V and its index in the low
+                    nibble if the instruction loads a V register (Vx for
+                    Fx65), TRACE_VF if it sets VF as a flag
+                u8  value of that V register after the instruction
+                u16 first address written, u8 bytes written there
+                u8  VF after the instruction
+
+    Recording writes into a per-emulator ring that a background thread
+    drains to the file; the ring is already in file byte order, so only
+    little-endian hosts can record. A full ring makes the emulator wait
+    rather than drop records; the waits are counted as stalls.
+*/
+
+#define TRACE_VERSION 1
+#define TRACE_RING (1 << 18)
+
+#define TRACE_V  0x10
+#define TRACE_VF 0x20
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t start;
+} TraceHeader;
+
+typedef struct
+{
+    uint32_t count;
+    uint16_t pc;
+    uint16_t opcode;
+    uint16_t i;
+    uint8_t reg;
+    uint8_t value;
+    uint16_t addr;
+    uint8_t writes;
+    uint8_t vf;
+} TraceRecord;
+
+_Static_assert(sizeof(TraceHeader) == 24, "trace header must be 24 bytes");
+_Static_assert(sizeof(TraceRecord) == 16, "trace record must be 16 bytes");
+
+typedef struct
+{
+    _Alignas(64) _Atomic uint64_t head;
+    uint64_t cached_tail;
+    uint64_t stalls;
+    _Alignas(64) _Atomic uint64_t tail;
+    atomic_int stop;
+    int fd;
+    int failed;
+    TraceRecord *ring;
+    pthread_t thread;
+} Tracer;
+
+int open_trace(Tracer *tracer, const char *path, uint64_t start);
+void trace_cycles(Tracer *tracer, Chip8 *chip, int count);
+uint64_t close_trace(Tracer *tracer);
+
+#endif
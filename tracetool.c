@@ -0,0 +1,403 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "trace.h"
+#include "disasm.h"
+
+/*
+    chip8-trace: offline reader for traces recorded with chip8 --trace.
+    Lists records with optional filters, prints a per-address profile,
+    or walks two traces in step and reports the first record where they
+    disagree, with the instructions that led up to it. The traces may
+    come from different engines; instruction counts are not compared,
+    only what the instructions did.
+*/
+
+#define READ_BATCH 4096
+#define MAX_CONTEXT 256
+
+typedef struct
+{
+    FILE *file;
+    TraceHeader header;
+    TraceRecord batch[READ_BATCH];
+    size_t batch_size;
+    size_t next;
+    uint64_t high;
+    uint32_t last;
+    uint64_t index;
+} TraceReader;
+
+typedef struct
+{
+    TraceRecord record;
+    uint64_t count;
+} Entry;
+
+typedef struct
+{
+    uint64_t from;
+    uint64_t to;
+    int pc;
+    uint16_t op_value;
+    uint16_t op_mask;
+    int reg;
+    int writes;
+} Filter;
+
+static int
+open_reader(TraceReader *reader, const char *path)
+{
+    memset(reader, 0, sizeof(*reader));
+    reader->file = fopen(path, "rb");
+
+    if(!reader->file)
+    {
+        perror(path);
+        return -1;
+    }
+
+    if(fread(&reader->header, sizeof(reader->header), 1, reader->file) != 1 ||
+       memcmp(reader->header.magic, "C8TRACE", 8) != 0 ||
+       reader->header.record_size != sizeof(TraceRecord))
+    {
+        fprintf(stderr, "%s: not a chip8 trace\n", path);
+        fclose(reader->file);
+        return -1;
+    }
+
+    reader->high = reader->header.start & ~(uint64_t)UINT32_MAX;
+    reader->last = (uint32_t)reader->header.start;
+
+    return 0;
+}
+
+/*
+    Records carry the low 32 bits of the instruction count; the full
+    count is rebuilt by noticing when they wrap.
+*/
+
+static int
+next_record(TraceReader *reader, Entry *entry)
+{
+    if(reader->next == reader->batch_size)
+    {
+        reader->batch_size = fread(reader->batch, sizeof(TraceRecord), READ_BATCH, reader->file);
+        reader->next = 0;
+
+        if(reader->batch_size == 0)
+            return 0;
+    }
+
+    entry->record = reader->batch[reader->next++];
+
+    if(entry->record.count < reader->last)
+        reader->high += (uint64_t)1 << 32;
+
+    reader->last = entry->record.count;
+    entry->count = reader->high | entry->record.count;
+    reader->index++;
+
+    return 1;
+}
+
+static void
+print_entry(const Entry *entry, const char *prefix)
+{
+    const TraceRecord *record = &entry->record;
+    char text[32];
+
+    disassemble(record->opcode, text, sizeof(text));
+    printf("%s%12llu  %03X  %04X  %-18s I=%03X", prefix, (unsigned long long)entry->count,
+           record->pc, record->opcode, text, record->i);
+
+    if(record->reg & TRACE_V)
+        printf("  V%X=%02X", record->reg & 0x0F, record->value);
+
+    if(record->reg & TRACE_VF)
+        printf("  VF=%02X", record->vf);
+
+    if(record->writes)
+        printf("  [%03X..%03X]", record->addr, record->addr + record->writes - 1);
+
+    printf("\n");
+}
+
+static int
+parse_opcode_pattern(const char *pattern, Filter *filter)
+{
+    if(strlen(pattern) != 4)
+        return -1;
+
+    // hex digits must match, anything else is a wildcard, so Fx55 or 8xy4 work
+    for(int n = 0; n < 4; n++)
+    {
+        int c = tolower((unsigned char)pattern[n]);
+        int shift = (3 - n) * 4;
+        int digit = isdigit(c) ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+
+        if(digit >= 0)
+        {
+            filter->op_value |= (uint16_t)(digit << shift);
+            filter->op_mask |= (uint16_t)(0xF << shift);
+        }
+    }
+
+    return 0;
+}
+
+static int
+matches(const Filter *filter, const Entry *entry)
+{
+    const TraceRecord *record = &entry->record;
+
+    if(entry->count < filter->from || entry->count > filter->to)
+        return 0;
+    if(filter->pc >= 0 && record->pc != filter->pc)
+        return 0;
+    if((record->opcode & filter->op_mask) != filter->op_value)
+        return 0;
+    if(filter->writes && !record->writes)
+        return 0;
+    if(filter->reg == 15 && !(record->reg & TRACE_VF))
+        return 0;
+    if(filter->reg >= 0 && filter->reg < 15 &&
+       (!(record->reg & TRACE_V) || (record->reg & 0x0F) != filter->reg))
+        return 0;
+
+    return 1;
+}
+
+static int
+dump_trace(const char *path, const Filter *filter)
+{
+    TraceReader reader;
+    Entry entry;
+
+    if(open_reader(&reader, path))
+        return 1;
+
+    while(next_record(&reader, &entry))
+    {
+        if(entry.count > filter->to)
+            break;
+        if(matches(filter, &entry))
+            print_entry(&entry, "");
+    }
+
+    fclose(reader.file);
+
+    return 0;
+}
+
+static int
+trace_stats(const char *path)
+{
+    static uint64_t pcs[4096];
+    uint64_t series[16] = { 0 };
+    uint64_t writes = 0;
+    TraceReader reader;
+    Entry entry;
+    Entry first = { 0 };
+
+    if(open_reader(&reader, path))
+        return 1;
+
+    while(next_record(&reader, &entry))
+    {
+        if(reader.index == 1)
+            first = entry;
+
+        pcs[entry.record.pc & 0xFFF]++;
+        series[entry.record.opcode >> 12]++;
+        writes += entry.record.writes;
+    }
+
+    fclose(reader.file);
+
+    if(reader.index == 0)
+    {
+        printf("empty trace\n");
+        return 0;
+    }
+
+    printf("%llu records, instructions %llu-%llu, %llu bytes written\n",
+           (unsigned long long)reader.index, (unsigned long long)first.count,
+           (unsigned long long)entry.count, (unsigned long long)writes);
+
+    printf("\nby opcode group:\n");
+
+    for(int s = 0; s < 16; s++)
+        if(series[s])
+            printf("  %Xxxx  %12llu  %5.1f%%\n", s, (unsigned long long)series[s], 100.0 * series[s] / reader.index);
+
+    printf("\nhottest addresses:\n");
+
+    for(int n = 0; n < 10; n++)
+    {
+        int best = -1;
+
+        for(int addr = 0; addr < 4096; addr++)
+            if(pcs[addr] && (best < 0 || pcs[addr] > pcs[best]))
+                best = addr;
+
+        if(best < 0)
+            break;
+
+        printf("  %03X  %12llu  %5.1f%%\n", best, (unsigned long long)pcs[best], 100.0 * pcs[best] / reader.index);
+        pcs[best] = 0;
+    }
+
+    return 0;
+}
+
+static int
+same_effect(const TraceRecord *a, const TraceRecord *b)
+{
+    return a->pc == b->pc && a->opcode == b->opcode && a->i == b->i && a->reg == b->reg &&
+           a->value == b->value && a->vf == b->vf && a->writes == b->writes &&
+           (!a->writes || a->addr == b->addr);
+}
+
+/*
+    Keeps the last `context` matching records in a ring so they can be
+    shown once the traces part ways.
+*/
+
+static int
+diff_traces(const char *path_a, const char *path_b, int context)
+{
+    static Entry history[MAX_CONTEXT];
+    TraceReader a, b;
+    Entry entry_a, entry_b;
+    int status = 0;
+
+    if(open_reader(&a, path_a))
+        return 2;
+
+    if(open_reader(&b, path_b))
+    {
+        fclose(a.file);
+        return 2;
+    }
+
+    for(;;)
+    {
+        int more_a = next_record(&a, &entry_a);
+        int more_b = next_record(&b, &entry_b);
+
+        if(!more_a && !more_b)
+        {
+            printf("traces match for all %llu records\n", (unsigned long long)a.index);
+            break;
+        }
+
+        if(more_a && more_b && same_effect(&entry_a.record, &entry_b.record))
+        {
+            if(context > 0)
+                history[a.index % context] = entry_a;
+            continue;
+        }
+
+        uint64_t index = more_a ? a.index : b.index;
+        uint64_t shown = (index - 1) < (uint64_t)context ? index - 1 : (uint64_t)context;
+
+        printf("traces diverge at record %llu\n", (unsigned long long)index);
+
+        for(uint64_t n = index - shown; n < index; n++)
+            print_entry(&history[n % context], "  ");
+
+        if(more_a)
+            print_entry(&entry_a, "A ");
+        else
+            printf("A ends after %llu records\n", (unsigned long long)a.index);
+
+        if(more_b)
+            print_entry(&entry_b, "B ");
+        else
+            printf("B ends after %llu records\n", (unsigned long long)b.index);
+
+        status = 1;
+        break;
+    }
+
+    fclose(a.file);
+    fclose(b.file);
+
+    return status;
+}
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr, "usage: %s dump TRACE [filters]\n"
+                    "       %s stats TRACE\n"
+                    "       %s diff TRACE_A TRACE_B [--context N]\n"
+                    "filters:\n"
+                    "  --from N       skip instructions before count N\n"
+                    "  --to N         stop after instruction count N\n"
+                    "  --pc ADDR      only instructions at hex address ADDR\n"
+                    "  --op PATTERN   only opcodes matching e.g. Fx55, 8xy4 or D...\n"
+                    "  --reg X        only instructions that wrote register VX\n"
+                    "  --writes       only instructions that wrote memory\n",
+            name, name, name);
+}
+
+int
+main(int argc, char **argv)
+{
+    Filter filter = { 0, UINT64_MAX, -1, 0, 0, -1, 0 };
+    int context = 8;
+    char *paths[2] = { NULL, NULL };
+    int path_count = 0;
+
+    if(argc < 3)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    for(int i = 2; i < argc; i++)
+    {
+        char *arg = argv[i];
+        int has_value = i + 1 < argc;
+
+        if(strcmp(arg, "--from") == 0 && has_value)
+            filter.from = strtoull(argv[++i], NULL, 10);
+        else if(strcmp(arg, "--to") == 0 && has_value)
+            filter.to = strtoull(argv[++i], NULL, 10);
+        else if(strcmp(arg, "--pc") == 0 && has_value)
+            filter.pc = (int)strtol(argv[++i], NULL, 16);
+        else if(strcmp(arg, "--op") == 0 && has_value && parse_opcode_pattern(argv[i + 1], &filter) == 0)
+            i++;
+        else if(strcmp(arg, "--reg") == 0 && has_value)
+            filter.reg = (int)strtol(argv[++i], NULL, 16) & 0x0F;
+        else if(strcmp(arg, "--writes") == 0)
+            filter.writes = 1;
+        else if(strcmp(arg, "--context") == 0 && has_value)
+            context = atoi(argv[++i]);
+        else if(arg[0] != '-' && path_count < 2)
+            paths[path_count++] = arg;
+        else
+        {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if(context < 0)
+        context = 0;
+    if(context > MAX_CONTEXT)
+        context = MAX_CONTEXT;
+
+    if(strcmp(argv[1], "dump") == 0 && path_count == 1)
+        return dump_trace(paths[0], &filter);
+    if(strcmp(argv[1], "stats") == 0 && path_count == 1)
+        return trace_stats(paths[0]);
+    if(strcmp(argv[1], "diff") == 0 && path_count == 2)
+        return diff_traces(paths[0], paths[1], context);
+
+    usage(argv[0]);
+    return 2;
+}
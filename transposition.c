@@ -0,0 +1,85 @@
+#include <stdlib.h>
+#include "transposition.h"
+
+#define MAX_PROBE 64
+
+int
+init_transposition(TranspositionTable *table, int bits)
+{
+    size_t size = (size_t)1 << bits;
+
+    table->keys = calloc(size, sizeof(*table->keys));
+    table->mask = size - 1;
+    atomic_init(&table->count, 0);
+
+    return table->keys ? 0 : -1;
+}
+
+void
+free_transposition(TranspositionTable *table)
+{
+    free((void *)table->keys);
+    table->keys = NULL;
+}
+
+// 0 marks an empty slot
+static uint64_t
+table_key(uint64_t hash)
+{
+    return hash ? hash : 1;
+}
+
+/*
+    Returns 1 if the state was not in the table (and now is), 0 if some
+    thread inserted it before.
+*/
+
+int
+insert_state(TranspositionTable *table, uint64_t hash)
+{
+    uint64_t key = table_key(hash);
+
+    for(uint64_t n = 0; n < MAX_PROBE; n++)
+    {
+        _Atomic uint64_t *slot = &table->keys[(key + n) & table->mask];
+        uint64_t current = atomic_load_explicit(slot, memory_order_relaxed);
+
+        if(current == key)
+            return 0;
+
+        if(current == 0)
+        {
+            uint64_t expected = 0;
+
+            if(atomic_compare_exchange_strong_explicit(slot, &expected, key, memory_order_relaxed,
+                                                       memory_order_relaxed))
+            {
+                atomic_fetch_add_explicit(&table->count, 1, memory_order_relaxed);
+                return 1;
+            }
+
+            if(expected == key)
+                return 0;
+        }
+    }
+
+    return 1;
+}
+
+int
+contains_state(TranspositionTable *table, uint64_t hash)
+{
+    uint64_t key = table_key(hash);
+
+    for(uint64_t n = 0; n < MAX_PROBE; n++)
+    {
+        uint64_t current = atomic_load_explicit(&table->keys[(key + n) & table->mask], memory_order_relaxed);
+
+        if(current == key)
+            return 1;
+        if(current == 0)
+            return 0;
+    }
+
+    return 0;
+}
@@ -0,0 +1,27 @@
+#ifndef TRANSPOSITION_H
+#define TRANSPOSITION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+    Lock-free set of state hashes for deduplicating search states,
+    shared by any number of threads. Fixed capacity, open addressing
+    with linear probing; a full probe window reports the state as new,
+    so a crowded table costs re-expansion but never correctness.
+*/
+
+typedef struct
+{
+    _Atomic uint64_t *keys;
+    uint64_t mask;
+    atomic_size_t count;
+} TranspositionTable;
+
+int init_transposition(TranspositionTable *table, int bits);
+void free_transposition(TranspositionTable *table);
+int insert_state(TranspositionTable *table, uint64_t hash);
+int contains_state(TranspositionTable *table, uint64_t hash);
+
+#endif